@@ -0,0 +1,318 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "log.h"
+
+RipExtConfig g_Config;
+
+void RipExtConfig::Load()
+{
+	ReadSMC_ParseStart();
+
+	char path[PLATFORM_MAX_PATH];
+	smutils->BuildPath(Path_SM, path, sizeof(path), SM_RIPEXT_CONFIG_PATH);
+
+	/* The config file is optional, defaults are used without it */
+	FILE *file = fopen(path, "r");
+	if (file == nullptr)
+	{
+		return;
+	}
+	fclose(file);
+
+	SMCStates states = {0, 0};
+	SMCError err = textparsers->ParseFile_SMC(path, this, &states);
+	if (err != SMCError_Okay)
+	{
+		const char *error = textparsers->GetSMCErrorString(err);
+		g_RipExt.LogError("Error parsing %s (line %d): %s", path, states.line, error ? error : "Unknown error");
+	}
+}
+
+long RipExtConfig::GetOption(HTTPOption option) const
+{
+	return options[option].load();
+}
+
+void RipExtConfig::SetOption(HTTPOption option, long value)
+{
+	options[option] = value;
+}
+
+void RipExtConfig::ApplyMultiOptions(CURLM *multi) const
+{
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, options[HTTPOption_Multiplex] ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+	curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, options[HTTPOption_MaxTotalConnections].load());
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, options[HTTPOption_MaxHostConnections].load());
+
+	/* A cache size of 0 lets libcurl size the cache from the number of handles */
+	if (options[HTTPOption_MaxConnectionCache] > 0)
+	{
+		curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, options[HTTPOption_MaxConnectionCache].load());
+	}
+}
+
+bool RipExtConfig::IsMultiOption(HTTPOption option)
+{
+	switch (option)
+	{
+		case HTTPOption_Multiplex:
+		case HTTPOption_MaxTotalConnections:
+		case HTTPOption_MaxHostConnections:
+		case HTTPOption_MaxConnectionCache:
+			return true;
+		default:
+			return false;
+	}
+}
+
+long RipExtConfig::GetHTTPVersion(long requested, const std::string &host) const
+{
+	if (requested != CURL_HTTP_VERSION_NONE)
+	{
+		return requested;
+	}
+
+	auto iter = hostVersions.find(host);
+	if (iter != hostVersions.end())
+	{
+		return iter->second;
+	}
+
+	return options[HTTPOption_HTTPVersion];
+}
+
+void RipExtConfig::ReadSMC_ParseStart()
+{
+	options[HTTPOption_Multiplex] = 1;
+	options[HTTPOption_MaxTotalConnections] = 0;
+	options[HTTPOption_MaxHostConnections] = 0;
+	options[HTTPOption_MaxConnectionCache] = 0;
+	options[HTTPOption_MaxBulkTransfers] = 0;
+	options[HTTPOption_BulkMaxRecvSpeed] = 0;
+	options[HTTPOption_BulkMaxSendSpeed] = 0;
+	options[HTTPOption_MaxPluginInFlight] = 0;
+	options[HTTPOption_MaxPluginQueued] = 0;
+	options[HTTPOption_MaxDispatchLatency] = 250;
+	options[HTTPOption_DispatchBudget] = 2000;
+	options[HTTPOption_LogLevel] = LogLevel_Info;
+	options[HTTPOption_LogRateLimit] = 10;
+	options[HTTPOption_ProgressRate] = 10;
+	options[HTTPOption_MaxStartsPerWakeup] = 10;
+#ifdef WIN32
+	options[HTTPOption_HTTPVersion] = CURL_HTTP_VERSION_1_1;
+#else
+	options[HTTPOption_HTTPVersion] = CURL_HTTP_VERSION_NONE;
+#endif
+
+	hostVersions.clear();
+	logFile.clear();
+	webSocketThreads = 1;
+	unifiedLoop = false;
+
+	depth = 0;
+	inHTTP = false;
+	inHosts = false;
+	inLogging = false;
+	inWebSocket = false;
+	currentHost.clear();
+}
+
+SMCResult RipExtConfig::ReadSMC_NewSection(const SMCStates *states, const char *name)
+{
+	depth++;
+
+	if (depth == 2)
+	{
+		inHTTP = (strcmp(name, "HTTP") == 0);
+		inHosts = (strcmp(name, "Hosts") == 0);
+		inLogging = (strcmp(name, "Logging") == 0);
+		inWebSocket = (strcmp(name, "WebSocket") == 0);
+	}
+	else if (depth == 3 && inHosts)
+	{
+		currentHost = name;
+	}
+
+	return SMCResult_Continue;
+}
+
+SMCResult RipExtConfig::ReadSMC_KeyValue(const SMCStates *states, const char *key, const char *value)
+{
+	if (depth == 2 && inHTTP)
+	{
+		if (strcmp(key, "multiplex") == 0)
+		{
+			options[HTTPOption_Multiplex] = atoi(value) != 0;
+		}
+		else if (strcmp(key, "max_total_connections") == 0)
+		{
+			options[HTTPOption_MaxTotalConnections] = atol(value);
+		}
+		else if (strcmp(key, "max_host_connections") == 0)
+		{
+			options[HTTPOption_MaxHostConnections] = atol(value);
+		}
+		else if (strcmp(key, "max_connection_cache") == 0)
+		{
+			options[HTTPOption_MaxConnectionCache] = atol(value);
+		}
+		else if (strcmp(key, "max_bulk_transfers") == 0)
+		{
+			options[HTTPOption_MaxBulkTransfers] = atol(value);
+		}
+		else if (strcmp(key, "bulk_max_recv_speed") == 0)
+		{
+			options[HTTPOption_BulkMaxRecvSpeed] = atol(value);
+		}
+		else if (strcmp(key, "bulk_max_send_speed") == 0)
+		{
+			options[HTTPOption_BulkMaxSendSpeed] = atol(value);
+		}
+		else if (strcmp(key, "max_plugin_in_flight") == 0)
+		{
+			options[HTTPOption_MaxPluginInFlight] = atol(value);
+		}
+		else if (strcmp(key, "max_plugin_queued") == 0)
+		{
+			options[HTTPOption_MaxPluginQueued] = atol(value);
+		}
+		else if (strcmp(key, "max_dispatch_latency") == 0)
+		{
+			options[HTTPOption_MaxDispatchLatency] = atol(value);
+		}
+		else if (strcmp(key, "dispatch_budget") == 0)
+		{
+			options[HTTPOption_DispatchBudget] = atol(value);
+		}
+		else if (strcmp(key, "progress_rate") == 0)
+		{
+			options[HTTPOption_ProgressRate] = atol(value);
+		}
+		else if (strcmp(key, "max_starts_per_wakeup") == 0)
+		{
+			options[HTTPOption_MaxStartsPerWakeup] = atol(value);
+		}
+		else if (strcmp(key, "http_version") == 0)
+		{
+			long version;
+			if (ParseHTTPVersion(value, &version))
+			{
+				options[HTTPOption_HTTPVersion] = version;
+			}
+			else
+			{
+				g_RipExt.LogError("Invalid HTTP version \"%s\" on line %d", value, states->line);
+			}
+		}
+	}
+	else if (depth == 2 && inLogging)
+	{
+		if (strcmp(key, "level") == 0)
+		{
+			long level;
+			if (Logger::ParseLevel(value, &level))
+			{
+				options[HTTPOption_LogLevel] = level;
+			}
+			else
+			{
+				g_RipExt.LogError("Invalid log level \"%s\" on line %d", value, states->line);
+			}
+		}
+		else if (strcmp(key, "rate_limit") == 0)
+		{
+			options[HTTPOption_LogRateLimit] = atol(value);
+		}
+		else if (strcmp(key, "file") == 0)
+		{
+			logFile = value;
+		}
+	}
+	else if (depth == 2 && inWebSocket)
+	{
+		if (strcmp(key, "threads") == 0)
+		{
+			webSocketThreads = atol(value);
+		}
+		else if (strcmp(key, "unified_loop") == 0)
+		{
+			unifiedLoop = atoi(value) != 0;
+		}
+	}
+	else if (depth == 3 && inHosts && strcmp(key, "http_version") == 0)
+	{
+		long version;
+		if (ParseHTTPVersion(value, &version))
+		{
+			hostVersions[currentHost] = version;
+		}
+		else
+		{
+			g_RipExt.LogError("Invalid HTTP version \"%s\" for host %s on line %d", value, currentHost.c_str(), states->line);
+		}
+	}
+
+	return SMCResult_Continue;
+}
+
+SMCResult RipExtConfig::ReadSMC_LeavingSection(const SMCStates *states)
+{
+	if (depth == 2)
+	{
+		inHTTP = false;
+		inHosts = false;
+		inLogging = false;
+		inWebSocket = false;
+	}
+
+	depth--;
+
+	return SMCResult_Continue;
+}
+
+bool RipExtConfig::ParseHTTPVersion(const char *value, long *version)
+{
+	static const struct
+	{
+		const char *name;
+		long version;
+	} versions[] = {
+		{"default",				CURL_HTTP_VERSION_NONE},
+		{"1.0",					CURL_HTTP_VERSION_1_0},
+		{"1.1",					CURL_HTTP_VERSION_1_1},
+		{"2",					CURL_HTTP_VERSION_2_0},
+		{"2tls",				CURL_HTTP_VERSION_2TLS},
+		{"2-prior-knowledge",	CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE},
+	};
+
+	for (const auto &entry : versions)
+	{
+		if (strcmp(value, entry.name) == 0)
+		{
+			*version = entry.version;
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,101 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_CONFIG_H_
+#define SM_RIPEXT_CONFIG_H_
+
+#include "extension.h"
+#include <atomic>
+#include <map>
+
+#define SM_RIPEXT_CONFIG_PATH "configs/ripext/ripext.cfg"
+
+enum HTTPOption
+{
+	HTTPOption_Multiplex = 0,
+	HTTPOption_MaxTotalConnections,
+	HTTPOption_MaxHostConnections,
+	HTTPOption_MaxConnectionCache,
+	HTTPOption_HTTPVersion,
+	HTTPOption_MaxBulkTransfers,
+	HTTPOption_BulkMaxRecvSpeed,
+	HTTPOption_BulkMaxSendSpeed,
+	HTTPOption_MaxPluginInFlight,
+	HTTPOption_MaxPluginQueued,
+	HTTPOption_MaxDispatchLatency,
+	HTTPOption_DispatchBudget,
+	HTTPOption_LogLevel,
+	HTTPOption_LogRateLimit,
+	HTTPOption_ProgressRate,
+	HTTPOption_MaxStartsPerWakeup,
+
+	HTTPOption_Count
+};
+
+/* HTTP versions are passed straight to CURLOPT_HTTP_VERSION */
+#define HTTP_VERSION_MAX CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE
+
+class RipExtConfig : public ITextListener_SMC
+{
+public:
+	void Load();
+
+	long GetOption(HTTPOption option) const;
+	void SetOption(HTTPOption option, long value);
+	void ApplyMultiOptions(CURLM *multi) const;
+	static bool IsMultiOption(HTTPOption option);
+
+	/* Safe to call from the network thread, hosts are only written while loading */
+	long GetHTTPVersion(long requested, const std::string &host) const;
+
+	const std::string &GetLogFile() const { return logFile; }
+
+	/* Only read when the extension loads */
+	long GetWebSocketThreads() const { return webSocketThreads; }
+	bool GetUnifiedLoop() const { return unifiedLoop; }
+
+public: // ITextListener_SMC
+	void ReadSMC_ParseStart();
+	SMCResult ReadSMC_NewSection(const SMCStates *states, const char *name);
+	SMCResult ReadSMC_KeyValue(const SMCStates *states, const char *key, const char *value);
+	SMCResult ReadSMC_LeavingSection(const SMCStates *states);
+
+private:
+	static bool ParseHTTPVersion(const char *value, long *version);
+
+private:
+	std::atomic<long> options[HTTPOption_Count];
+	std::map<std::string, long> hostVersions;
+	std::string logFile;
+	long webSocketThreads = 1;
+	bool unifiedLoop = false;
+
+	int depth = 0;
+	bool inHTTP = false;
+	bool inHosts = false;
+	bool inLogging = false;
+	bool inWebSocket = false;
+	std::string currentHost;
+};
+
+extern RipExtConfig g_Config;
+
+#endif // SM_RIPEXT_CONFIG_H_
@@ -0,0 +1,139 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "digest.h"
+#include <zlib.h>
+#include <algorithm>
+#include <ctype.h>
+
+Digest::Digest(DigestType type)
+	: type(type)
+{
+	Reset();
+}
+
+void Digest::Reset()
+{
+	switch (type)
+	{
+		case DigestType_MD5:
+			MD5_Init(&ctx.md5);
+			break;
+		case DigestType_SHA1:
+			SHA1_Init(&ctx.sha1);
+			break;
+		case DigestType_SHA256:
+			SHA256_Init(&ctx.sha256);
+			break;
+		case DigestType_CRC32:
+			ctx.crc32 = crc32(0L, Z_NULL, 0);
+			break;
+		default:
+			break;
+	}
+}
+
+void Digest::Update(const void *data, size_t size)
+{
+	switch (type)
+	{
+		case DigestType_MD5:
+			MD5_Update(&ctx.md5, data, size);
+			break;
+		case DigestType_SHA1:
+			SHA1_Update(&ctx.sha1, data, size);
+			break;
+		case DigestType_SHA256:
+			SHA256_Update(&ctx.sha256, data, size);
+			break;
+		case DigestType_CRC32:
+		{
+			/* crc32() takes a 32-bit length */
+			const Bytef *bytes = (const Bytef *)data;
+			while (size > 0)
+			{
+				uInt length = (uInt)std::min(size, (size_t)0x40000000);
+				ctx.crc32 = crc32(ctx.crc32, bytes, length);
+				bytes += length;
+				size -= length;
+			}
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+std::string Digest::Final()
+{
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	size_t length = 0;
+
+	switch (type)
+	{
+		case DigestType_MD5:
+			MD5_Final(md, &ctx.md5);
+			length = MD5_DIGEST_LENGTH;
+			break;
+		case DigestType_SHA1:
+			SHA1_Final(md, &ctx.sha1);
+			length = SHA_DIGEST_LENGTH;
+			break;
+		case DigestType_SHA256:
+			SHA256_Final(md, &ctx.sha256);
+			length = SHA256_DIGEST_LENGTH;
+			break;
+		case DigestType_CRC32:
+		{
+			char hex[9];
+			snprintf(hex, sizeof(hex), "%08lx", ctx.crc32 & 0xFFFFFFFFUL);
+			return hex;
+		}
+		default:
+			return "";
+	}
+
+	char hex[SHA256_DIGEST_LENGTH * 2 + 1];
+	for (size_t i = 0; i < length; i++)
+	{
+		snprintf(&hex[i * 2], 3, "%02x", md[i]);
+	}
+
+	return std::string(hex, length * 2);
+}
+
+bool Digest::Matches(const std::string &digest, const std::string &expected)
+{
+	if (digest.size() != expected.size())
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < digest.size(); i++)
+	{
+		if (tolower((unsigned char)digest[i]) != tolower((unsigned char)expected[i]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
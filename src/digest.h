@@ -0,0 +1,72 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_DIGEST_H_
+#define SM_RIPEXT_DIGEST_H_
+
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+#include <string>
+
+enum DigestType
+{
+	DigestType_None = 0,
+	DigestType_MD5,
+	DigestType_SHA1,
+	DigestType_SHA256,
+	DigestType_CRC32,
+
+	DigestType_Count
+};
+
+/*
+ * Computes a digest incrementally, so data can be hashed while it is being
+ * transferred instead of reading it back afterwards.
+ */
+class Digest
+{
+public:
+	Digest(DigestType type = DigestType_None);
+
+	void Reset();
+	void Update(const void *data, size_t size);
+
+	/* Returns the lowercase hex digest, the digest must be reset before it is updated again */
+	std::string Final();
+
+	/* Compares a hex digest case insensitively */
+	static bool Matches(const std::string &digest, const std::string &expected);
+
+	DigestType GetType() const { return type; }
+
+private:
+	DigestType type;
+
+	union
+	{
+		MD5_CTX md5;
+		SHA_CTX sha1;
+		SHA256_CTX sha256;
+		unsigned long crc32;
+	} ctx;
+};
+
+#endif // SM_RIPEXT_DIGEST_H_
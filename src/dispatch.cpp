@@ -0,0 +1,136 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dispatch.h"
+#include "config.h"
+#include <sourcehook.h>
+
+/* Newest interface version of IServerGameDLL that is looked for */
+#define MAX_SERVERGAMEDLL_VERSION 20
+
+/* The offset differs between engines, it is set from gamedata */
+SH_DECL_MANUALHOOK1_void(ServerThink, 0, 0, 0, bool);
+
+/* Event nodes allocated up front, enough for a busy frame of WebSocket messages */
+#define PREALLOCATED_EVENTS 256
+
+Dispatcher g_Dispatcher;
+
+Dispatcher::Dispatcher()
+	: events(PREALLOCATED_EVENTS)
+{
+}
+
+void Dispatcher::FindGameDLL(CreateInterfaceFn serverFactory)
+{
+	char name[32];
+
+	/* Games expose different versions, all of them have Think */
+	for (int version = MAX_SERVERGAMEDLL_VERSION; version > 0 && gameDLL == nullptr; version--)
+	{
+		snprintf(name, sizeof(name), "ServerGameDLL%03d", version);
+		gameDLL = serverFactory(name, nullptr);
+	}
+}
+
+void Dispatcher::Init(DispatchFunc dispatch)
+{
+	this->dispatch = dispatch;
+	this->lastFrame = uv_hrtime();
+
+	HookThink();
+}
+
+void Dispatcher::Shutdown()
+{
+	if (thinkHook != 0)
+	{
+		SH_REMOVE_HOOK_ID(thinkHook);
+		thinkHook = 0;
+	}
+
+	/* The plugins these callbacks belong to are gone or about to be */
+	events.Clear();
+}
+
+void Dispatcher::OnGameFrame()
+{
+	lastFrame = uv_hrtime();
+
+	dispatch(false);
+	RunDeferred();
+}
+
+void Dispatcher::RunDeferred()
+{
+	/* Whatever does not fit in the budget is left for the next frame */
+	uint64_t budget = (uint64_t)g_Config.GetOption(HTTPOption_DispatchBudget) * 1000;
+
+	if (!events.Drain(budget))
+	{
+		budgetExhausted++;
+	}
+}
+
+void Dispatcher::HookThink()
+{
+	if (gameDLL == nullptr)
+	{
+		smutils->LogError(myself, "Could not find the server game interface, callbacks wait while the server hibernates");
+		return;
+	}
+
+	char error[256];
+	IGameConfig *gameConfig;
+	if (!gameconfs->LoadGameConfigFile(SM_RIPEXT_GAMEDATA, &gameConfig, error, sizeof(error)))
+	{
+		smutils->LogError(myself, "Could not read " SM_RIPEXT_GAMEDATA ".txt, callbacks wait while the server hibernates: %s", error);
+		return;
+	}
+
+	int offset;
+	bool found = gameConfig->GetOffset("IServerGameDLL::Think", &offset);
+	gameconfs->CloseGameConfigFile(gameConfig);
+
+	if (!found)
+	{
+		smutils->LogMessage(myself, "No offset of IServerGameDLL::Think for this game, callbacks wait while the server hibernates");
+		return;
+	}
+
+	SH_MANUALHOOK_RECONFIGURE(ServerThink, offset, 0, 0);
+	thinkHook = SH_ADD_MANUALHOOK(ServerThink, gameDLL, SH_MEMBER(this, &Dispatcher::OnThink), true);
+}
+
+void Dispatcher::OnThink(bool finalTick)
+{
+	/* Only take over while no game frame has run for too long */
+	long latency = g_Config.GetOption(HTTPOption_MaxDispatchLatency);
+	if ((uv_hrtime() - lastFrame) / 1000000 >= (uint64_t)latency)
+	{
+		fallbackDispatches++;
+
+		dispatch(true);
+		RunDeferred();
+	}
+
+	RETURN_META(MRES_IGNORED);
+}
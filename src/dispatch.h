@@ -0,0 +1,80 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_DISPATCH_H_
+#define SM_RIPEXT_DISPATCH_H_
+
+#include "extension.h"
+#include "eventqueue.h"
+#include <atomic>
+
+typedef void (*DispatchFunc)(bool fallback);
+
+/* Gamedata file with the offset of IServerGameDLL::Think */
+#define SM_RIPEXT_GAMEDATA "ripext.games"
+
+/*
+ * Runs callbacks on the game thread. Game frames stop while the server is
+ * hibernating, and SourceMod timers with them, but the engine keeps calling
+ * IServerGameDLL::Think. A hook on it takes over dispatching whenever no frame
+ * has run within the maximum dispatch latency.
+ */
+class Dispatcher
+{
+public:
+	Dispatcher();
+
+	/* Called when Metamod attaches, before Init */
+	void FindGameDLL(CreateInterfaceFn serverFactory);
+	void Init(DispatchFunc dispatch);
+	void Shutdown();
+
+	/* Safe to call from any thread, the callback runs on the game thread */
+	template <class F>
+	void Defer(F &&callback)
+	{
+		events.Push(std::forward<F>(callback));
+	}
+
+	void OnGameFrame();
+	void RunDeferred();
+
+	uint64_t GetFallbackDispatches() const { return fallbackDispatches; }
+	uint64_t GetEventAllocations() const { return events.GetAllocations(); }
+	uint64_t GetBudgetExhausted() const { return budgetExhausted; }
+
+private:
+	void HookThink();
+	void OnThink(bool finalTick);
+
+private:
+	EventQueue events;
+	DispatchFunc dispatch = nullptr;
+	void *gameDLL = nullptr;
+	int thinkHook = 0;
+	uint64_t lastFrame = 0;
+	uint64_t fallbackDispatches = 0;
+	uint64_t budgetExhausted = 0;
+};
+
+extern Dispatcher g_Dispatcher;
+
+#endif // SM_RIPEXT_DISPATCH_H_
@@ -0,0 +1,275 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_EVENTQUEUE_H_
+#define SM_RIPEXT_EVENTQUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <uv.h>
+
+/* Callbacks up to this size are stored inside the event node without a heap allocation */
+#define EVENT_STORAGE_SIZE 96
+
+struct EventNode
+{
+	std::atomic<EventNode *> next{nullptr};
+
+	/* Runs the stored callback if asked to, then destroys it */
+	void (*invoke)(EventNode *node, bool run) = nullptr;
+
+	alignas(std::max_align_t) unsigned char storage[EVENT_STORAGE_SIZE];
+};
+
+/*
+ * Multi-producer, single-consumer queue of deferred callbacks.
+ *
+ * Network threads push events without taking a lock (Vyukov's intrusive MPSC
+ * queue), and the game thread drains them. Event nodes are recycled through a
+ * pool, so steady state traffic does not touch the allocator.
+ */
+class EventQueue
+{
+public:
+	EventQueue(size_t preallocate)
+	{
+		uv_mutex_init(&poolMutex);
+
+		head.store(&stub);
+		tail = &stub;
+
+		for (size_t i = 0; i < preallocate; i++)
+		{
+			EventNode *node = new EventNode;
+			node->next.store(freeList, std::memory_order_relaxed);
+			freeList = node;
+		}
+	}
+
+	~EventQueue()
+	{
+		Clear();
+
+		while (freeList != nullptr)
+		{
+			EventNode *node = freeList;
+			freeList = node->next.load(std::memory_order_relaxed);
+			delete node;
+		}
+
+		uv_mutex_destroy(&poolMutex);
+	}
+
+	/* Safe to call from any thread */
+	template <class F>
+	void Push(F &&callback)
+	{
+		typedef typename std::decay<F>::type Callable;
+
+		EventNode *node = Allocate();
+		Store<Callable>(node, std::forward<F>(callback), std::integral_constant<bool,
+			sizeof(Callable) <= EVENT_STORAGE_SIZE && alignof(Callable) <= alignof(std::max_align_t)>());
+
+		node->next.store(nullptr, std::memory_order_relaxed);
+		EventNode *prev = head.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+	}
+
+	/* Runs events until the queue is empty or the time budget in nanoseconds has run out, returns false in the latter case */
+	bool Drain(uint64_t budget)
+	{
+		uint64_t deadline = uv_hrtime() + budget;
+		EventNode *released = nullptr;
+		size_t count = 0;
+
+		EventNode *node;
+		while ((node = Pop()) != nullptr)
+		{
+			node->invoke(node, true);
+			node->next.store(released, std::memory_order_relaxed);
+			released = node;
+
+			/* Reading the clock is not free, so only check it every few events */
+			if ((++count & 15) == 0 && uv_hrtime() >= deadline)
+			{
+				Release(released);
+				return false;
+			}
+		}
+
+		Release(released);
+		return true;
+	}
+
+	/* Destroys all pending events without running them */
+	void Clear()
+	{
+		EventNode *released = nullptr;
+
+		EventNode *node;
+		while ((node = Pop()) != nullptr)
+		{
+			node->invoke(node, false);
+			node->next.store(released, std::memory_order_relaxed);
+			released = node;
+		}
+
+		Release(released);
+	}
+
+	uint64_t GetAllocations() const { return allocations.load(); }
+
+private:
+	template <class Callable, class F>
+	static void Store(EventNode *node, F &&callback, std::true_type)
+	{
+		new (node->storage) Callable(std::forward<F>(callback));
+		node->invoke = &InvokeInline<Callable>;
+	}
+
+	/* Oversized callbacks still work, they just cost an allocation */
+	template <class Callable, class F>
+	static void Store(EventNode *node, F &&callback, std::false_type)
+	{
+		*reinterpret_cast<Callable **>(node->storage) = new Callable(std::forward<F>(callback));
+		node->invoke = &InvokeHeap<Callable>;
+	}
+
+	template <class Callable>
+	static void InvokeInline(EventNode *node, bool run)
+	{
+		Callable *callback = reinterpret_cast<Callable *>(node->storage);
+		if (run)
+		{
+			(*callback)();
+		}
+		callback->~Callable();
+	}
+
+	template <class Callable>
+	static void InvokeHeap(EventNode *node, bool run)
+	{
+		Callable *callback = *reinterpret_cast<Callable **>(node->storage);
+		if (run)
+		{
+			(*callback)();
+		}
+		delete callback;
+	}
+
+	/* Consumer side of the MPSC queue, only called from the game thread */
+	EventNode *Pop()
+	{
+		EventNode *node = tail;
+		EventNode *next = node->next.load(std::memory_order_acquire);
+
+		if (node == &stub)
+		{
+			if (next == nullptr)
+			{
+				return nullptr;
+			}
+
+			tail = next;
+			node = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if (next != nullptr)
+		{
+			tail = next;
+			return node;
+		}
+
+		/* A producer is halfway through a push, pick the event up next time */
+		if (node != head.load(std::memory_order_acquire))
+		{
+			return nullptr;
+		}
+
+		stub.next.store(nullptr, std::memory_order_relaxed);
+		EventNode *prev = head.exchange(&stub, std::memory_order_acq_rel);
+		prev->next.store(&stub, std::memory_order_release);
+
+		next = node->next.load(std::memory_order_acquire);
+		if (next != nullptr)
+		{
+			tail = next;
+			return node;
+		}
+
+		return nullptr;
+	}
+
+	EventNode *Allocate()
+	{
+		uv_mutex_lock(&poolMutex);
+		EventNode *node = freeList;
+		if (node != nullptr)
+		{
+			freeList = node->next.load(std::memory_order_relaxed);
+		}
+		uv_mutex_unlock(&poolMutex);
+
+		/* The pool grows to the peak number of pending events and stays there */
+		if (node == nullptr)
+		{
+			node = new EventNode;
+			allocations++;
+		}
+
+		return node;
+	}
+
+	/* Returns a chain of nodes to the pool with a single lock */
+	void Release(EventNode *nodes)
+	{
+		if (nodes == nullptr)
+		{
+			return;
+		}
+
+		EventNode *last = nodes;
+		while (last->next.load(std::memory_order_relaxed) != nullptr)
+		{
+			last = last->next.load(std::memory_order_relaxed);
+		}
+
+		uv_mutex_lock(&poolMutex);
+		last->next.store(freeList, std::memory_order_relaxed);
+		freeList = nodes;
+		uv_mutex_unlock(&poolMutex);
+	}
+
+private:
+	std::atomic<EventNode *> head;
+	EventNode *tail;
+	EventNode stub;
+
+	uv_mutex_t poolMutex;
+	EventNode *freeList = nullptr;
+	std::atomic<uint64_t> allocations{0};
+};
+
+#endif // SM_RIPEXT_EVENTQUEUE_H_
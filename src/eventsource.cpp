@@ -0,0 +1,573 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eventsource.h"
+#include "config.h"
+#include "dispatch.h"
+#include "quota.h"
+
+struct ReconnectTimer
+{
+	uv_timer_t timer;
+	std::shared_ptr<EventSource> source;
+};
+
+static size_t ReceiveEvents(char *data, size_t size, size_t nmemb, void *userdata)
+{
+	EventSourceContext *context = (EventSourceContext *)userdata;
+	return context->Parse(data, size * nmemb);
+}
+
+static int CheckClosed(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+	/* Aborts the stream soon after the handle is closed, even if the server is silent */
+	EventSourceContext *context = (EventSourceContext *)clientp;
+	return context->IsClosed() ? 1 : 0;
+}
+
+EventSource::EventSource(const std::string &url, std::shared_ptr<PluginUsage> owner)
+	: url(url), owner(owner)
+{
+	CURLU *handle = curl_url();
+	if (handle != nullptr)
+	{
+		char *part;
+		if (curl_url_set(handle, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK
+			&& curl_url_get(handle, CURLUPART_HOST, &part, 0) == CURLUE_OK)
+		{
+			host = part;
+			curl_free(part);
+		}
+
+		curl_url_cleanup(handle);
+	}
+}
+
+bool EventSource::Connect(IChangeableForward *forward, IChangeableForward *errorForward, cell_t value, Handle_t hndl)
+{
+	if (this->forward != nullptr || closed)
+	{
+		return false;
+	}
+
+	this->forward = forward;
+	this->errorForward = errorForward;
+	this->value = value;
+	this->hndl = hndl;
+
+	Start();
+
+	return true;
+}
+
+void EventSource::Close()
+{
+	closed = true;
+
+	/* Forwards can only be released on the game thread */
+	if (forward != nullptr)
+	{
+		forwards->ReleaseForward(forward);
+		forward = nullptr;
+	}
+	if (errorForward != nullptr)
+	{
+		forwards->ReleaseForward(errorForward);
+		errorForward = nullptr;
+	}
+
+	std::shared_ptr<EventSource> source = shared_from_this();
+	g_RipExt.RunOnLoop([source]() {
+		source->StopReconnect();
+	});
+}
+
+void EventSource::SetHeader(const char *name, const char *value)
+{
+	std::string vstr(value);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	headers.replace(name, std::move(vstr));
+}
+
+std::string EventSource::GetLastEventId()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return lastEventId;
+}
+
+void EventSource::SetLastEventId(const std::string &id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	lastEventId = id;
+}
+
+void EventSource::Start()
+{
+	if (closed)
+	{
+		return;
+	}
+
+	EventSourceContext *context = new EventSourceContext(shared_from_this(), url, GetLastEventId(), BuildHeaders());
+	context->host = host;
+	context->httpVersion = g_Config.GetHTTPVersion(CURL_HTTP_VERSION_NONE, host);
+	context->owner = owner;
+
+	if (owner && !g_PluginQuotas.OnQueued(owner.get()))
+	{
+		context->rejected = true;
+	}
+
+	g_RipExt.AddRequestToQueue(context);
+}
+
+struct curl_slist *EventSource::BuildHeaders()
+{
+	struct curl_slist *headers = nullptr;
+	char header[8192];
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (HTTPHeaderMap::iterator iter = this->headers.iter(); !iter.empty(); iter.next())
+	{
+		snprintf(header, sizeof(header), "%s: %s", iter->key.c_str(), iter->value.c_str());
+		headers = curl_slist_append(headers, header);
+	}
+
+	headers = curl_slist_append(headers, "Accept: text/event-stream");
+	headers = curl_slist_append(headers, "Cache-Control: no-cache");
+
+	if (!lastEventId.empty())
+	{
+		snprintf(header, sizeof(header), "Last-Event-ID: %s", lastEventId.c_str());
+		headers = curl_slist_append(headers, header);
+	}
+
+	return headers;
+}
+
+void EventSource::OnEvent(SSEEvent &&event)
+{
+	bool wakeup;
+
+	mutex.lock();
+	pending.push_back(std::move(event));
+	wakeup = !queued;
+	queued = true;
+	mutex.unlock();
+
+	/* Everything parsed until the game thread gets to it is delivered at once */
+	if (wakeup)
+	{
+		std::shared_ptr<EventSource> source = shared_from_this();
+		g_Dispatcher.Defer([source]() {
+			source->Deliver();
+		});
+	}
+}
+
+void EventSource::OnOpened()
+{
+	failures = 0;
+}
+
+void EventSource::OnDisconnected(const std::string &error, bool reconnect)
+{
+	if (closed)
+	{
+		return;
+	}
+
+	DeliverError(error, reconnect);
+
+	if (reconnect)
+	{
+		ScheduleReconnect();
+	}
+}
+
+void EventSource::ScheduleReconnect()
+{
+	/* Back off while the server keeps failing, a successful connection resets the delay */
+	int64_t delay = (int64_t)reconnectDelay.load() << std::min(failures, 5);
+	delay = std::min(delay, (int64_t)SSE_MAX_RECONNECT_DELAY);
+	failures++;
+
+	ReconnectTimer *timer = new ReconnectTimer;
+	timer->source = shared_from_this();
+	timer->timer.data = timer;
+
+	uv_timer_init(g_Loop, &timer->timer);
+	uv_timer_start(&timer->timer, &OnReconnect, delay, 0);
+
+	reconnectTimer = timer;
+}
+
+void EventSource::StopReconnect()
+{
+	if (reconnectTimer == nullptr)
+	{
+		return;
+	}
+
+	uv_timer_stop(&reconnectTimer->timer);
+	uv_close((uv_handle_t *)&reconnectTimer->timer, &OnTimerClosed);
+	reconnectTimer = nullptr;
+}
+
+void EventSource::OnReconnect(uv_timer_t *handle)
+{
+	ReconnectTimer *timer = (ReconnectTimer *)handle->data;
+	std::shared_ptr<EventSource> source = timer->source;
+
+	source->StopReconnect();
+	source->Start();
+}
+
+void EventSource::OnTimerClosed(uv_handle_t *handle)
+{
+	delete (ReconnectTimer *)handle->data;
+}
+
+void EventSource::Deliver()
+{
+	std::vector<SSEEvent> events;
+
+	mutex.lock();
+	events.swap(pending);
+	queued = false;
+	mutex.unlock();
+
+	for (const SSEEvent &event : events)
+	{
+		/* The callback may close the handle */
+		if (closed || forward == nullptr || forward->GetFunctionCount() == 0)
+		{
+			return;
+		}
+
+		forward->PushCell(hndl);
+		forward->PushString(event.type.c_str());
+		forward->PushString(event.data.c_str());
+		forward->PushString(event.id.c_str());
+		forward->PushCell(value);
+		forward->Execute(nullptr);
+	}
+}
+
+void EventSource::DeliverError(const std::string &error, bool reconnecting)
+{
+	std::shared_ptr<EventSource> source = shared_from_this();
+	g_Dispatcher.Defer([source, error, reconnecting]() {
+		/* Events received before the error are delivered first */
+		source->Deliver();
+
+		if (source->closed || source->errorForward == nullptr || source->errorForward->GetFunctionCount() == 0)
+		{
+			return;
+		}
+
+		source->errorForward->PushCell(source->hndl);
+		source->errorForward->PushString(error.c_str());
+		source->errorForward->PushCell(reconnecting);
+		source->errorForward->PushCell(source->value);
+		source->errorForward->Execute(nullptr);
+	});
+}
+
+EventSourceContext::EventSourceContext(std::shared_ptr<EventSource> source, const std::string &url, const std::string &lastEventId,
+									   struct curl_slist *headers)
+	: source(source), url(url), headers(headers), idBuffer(lastEventId)
+{
+}
+
+EventSourceContext::~EventSourceContext()
+{
+	curl_easy_cleanup(curl);
+	curl_slist_free_all(headers);
+}
+
+bool EventSourceContext::InitCurl()
+{
+	curl = curl_easy_init();
+	if (curl == nullptr)
+	{
+		smutils->LogError(myself, "Could not initialize cURL session.");
+		return false;
+	}
+
+	/* No overall timeout, the stream is meant to stay open */
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+	curl_easy_setopt(curl, CURLOPT_CAINFO, g_RipExt.caBundlePath);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, this);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, SM_RIPEXT_USER_AGENT);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &ReceiveEvents);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, &CheckClosed);
+
+	if (httpVersion != CURL_HTTP_VERSION_NONE)
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, httpVersion);
+	}
+
+#ifdef DEBUG
+	curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+#endif
+
+	return true;
+}
+
+void EventSourceContext::OnCompleted()
+{
+	/* Fire-and-forget, see OnLoopCompleted */
+}
+
+bool EventSourceContext::IsFireAndForget()
+{
+	return true;
+}
+
+void EventSourceContext::OnLoopCompleted(CURLcode result)
+{
+	if (!checkedResponse && result == CURLE_OK)
+	{
+		checkedResponse = true;
+		CheckResponse();
+	}
+
+	if (!failure.empty())
+	{
+		source->OnDisconnected(failure, retryFailure);
+	}
+	else if (result != CURLE_OK)
+	{
+		source->OnDisconnected(error[0] != '\0' ? error : curl_easy_strerror(result), true);
+	}
+	else
+	{
+		source->OnDisconnected("Connection closed by the server", true);
+	}
+}
+
+bool EventSourceContext::CheckResponse()
+{
+	long status = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+	char message[256];
+	if (status != 200)
+	{
+		/* Only errors that are likely to go away are retried */
+		snprintf(message, sizeof(message), "Unexpected response status %ld", status);
+		failure = message;
+		retryFailure = (status >= 500 || status == 429);
+		return false;
+	}
+
+	char *contentType = nullptr;
+	curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &contentType);
+
+	const char *expected = "text/event-stream";
+	if (contentType == nullptr || strncasecmp(contentType, expected, strlen(expected)) != 0)
+	{
+		snprintf(message, sizeof(message), "Unexpected content type %s", contentType != nullptr ? contentType : "(none)");
+		failure = message;
+		retryFailure = false;
+		return false;
+	}
+
+	source->OnOpened();
+	return true;
+}
+
+size_t EventSourceContext::Parse(const char *data, size_t size)
+{
+	if (!checkedResponse)
+	{
+		checkedResponse = true;
+		if (!CheckResponse())
+		{
+			return 0;
+		}
+	}
+
+	if (source->IsClosed())
+	{
+		return 0;
+	}
+
+	const char *end = data + size;
+
+	/* The stream may start with a byte order mark */
+	if (firstChunk)
+	{
+		firstChunk = false;
+		if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+		{
+			data += 3;
+		}
+	}
+
+	while (data < end)
+	{
+		/* A CR LF pair may be split across two chunks */
+		if (lastWasCR)
+		{
+			lastWasCR = false;
+			if (*data == '\n')
+			{
+				data++;
+				continue;
+			}
+		}
+
+		const char *eol = data;
+		while (eol < end && *eol != '\r' && *eol != '\n')
+		{
+			eol++;
+		}
+
+		AppendLine(data, eol - data);
+		if (!failure.empty())
+		{
+			return 0;
+		}
+
+		if (eol == end)
+		{
+			break;
+		}
+
+		lastWasCR = (*eol == '\r');
+		ParseLine();
+		data = eol + 1;
+	}
+
+	return size;
+}
+
+void EventSourceContext::AppendLine(const char *data, size_t size)
+{
+	if (line.size() + size > SSE_MAX_LINE_LENGTH)
+	{
+		failure = "Line too long";
+		retryFailure = true;
+		return;
+	}
+
+	line.append(data, size);
+}
+
+void EventSourceContext::ParseLine()
+{
+	if (line.empty())
+	{
+		DispatchEvent();
+		return;
+	}
+
+	/* Comments are used as keep-alives */
+	if (line[0] == ':')
+	{
+		line.clear();
+		return;
+	}
+
+	std::string field;
+	std::string value;
+
+	size_t colon = line.find(':');
+	if (colon == std::string::npos)
+	{
+		field = line;
+	}
+	else
+	{
+		field = line.substr(0, colon);
+		size_t start = colon + 1;
+		if (start < line.size() && line[start] == ' ')
+		{
+			start++;
+		}
+		value = line.substr(start);
+	}
+
+	line.clear();
+
+	if (field == "event")
+	{
+		eventType = std::move(value);
+	}
+	else if (field == "data")
+	{
+		data.append(value);
+		data.append("\n");
+	}
+	else if (field == "id")
+	{
+		if (value.find('\0') == std::string::npos)
+		{
+			idBuffer = std::move(value);
+		}
+	}
+	else if (field == "retry")
+	{
+		if (!value.empty() && value.find_first_not_of("0123456789") == std::string::npos && value.size() < 10)
+		{
+			source->reconnectDelay = atoi(value.c_str());
+		}
+	}
+}
+
+void EventSourceContext::DispatchEvent()
+{
+	source->SetLastEventId(idBuffer);
+
+	if (data.empty())
+	{
+		eventType.clear();
+		return;
+	}
+
+	/* Remove the newline appended after the last data line */
+	data.pop_back();
+
+	SSEEvent event;
+	event.type = eventType.empty() ? "message" : std::move(eventType);
+	event.data = std::move(data);
+	event.id = idBuffer;
+
+	source->OnEvent(std::move(event));
+
+	data.clear();
+	eventType.clear();
+}
@@ -0,0 +1,149 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_EVENTSOURCE_H_
+#define SM_RIPEXT_EVENTSOURCE_H_
+
+#include "extension.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/* Longest line accepted from the server, a longer one fails the connection */
+#define SSE_MAX_LINE_LENGTH (1024 * 1024)
+#define SSE_DEFAULT_RECONNECT_DELAY 3000
+#define SSE_MAX_RECONNECT_DELAY 60000
+
+struct SSEEvent
+{
+	std::string type;
+	std::string data;
+	std::string id;
+};
+
+class EventSourceContext;
+struct ReconnectTimer;
+
+/**
+ * Client for a text/event-stream endpoint, as described by the HTML living standard.
+ *
+ * A single streaming request is kept open on the event loop. Frames are parsed
+ * there as they arrive, and the events are handed to the game thread in batches,
+ * at most one dispatch at a time. When the stream ends or fails it is reopened
+ * after the reconnect delay, with the last event ID so the server can resume.
+ */
+class EventSource : public std::enable_shared_from_this<EventSource>
+{
+public:
+	EventSource(const std::string &url, std::shared_ptr<PluginUsage> owner);
+
+public: // Game thread
+	bool Connect(IChangeableForward *forward, IChangeableForward *errorForward, cell_t value, Handle_t hndl);
+	void Close();
+	void SetHeader(const char *name, const char *value);
+	std::string GetLastEventId();
+
+public: // Event loop thread
+	void OnEvent(SSEEvent &&event);
+	void OnOpened();
+	void OnDisconnected(const std::string &error, bool reconnect);
+	void SetLastEventId(const std::string &id);
+	bool IsClosed() const { return closed; }
+
+private:
+	void Start();
+	void ScheduleReconnect();
+	void Deliver();
+	void DeliverError(const std::string &error, bool reconnecting);
+	struct curl_slist *BuildHeaders();
+
+	static void OnReconnect(uv_timer_t *handle);
+	static void OnTimerClosed(uv_handle_t *handle);
+	void StopReconnect();
+
+public:
+	std::atomic<int> reconnectDelay{SSE_DEFAULT_RECONNECT_DELAY};
+
+private:
+	const std::string url;
+	std::string host;
+	std::shared_ptr<PluginUsage> owner;
+	std::atomic<bool> closed{false};
+
+	/* Game thread only */
+	IChangeableForward *forward = nullptr;
+	IChangeableForward *errorForward = nullptr;
+	cell_t value = 0;
+	Handle_t hndl = BAD_HANDLE;
+
+	/* Shared between the game thread and the event loop */
+	std::mutex mutex;
+	HTTPHeaderMap headers;
+	std::string lastEventId;
+	std::vector<SSEEvent> pending;
+	bool queued = false;
+
+	/* Event loop thread only */
+	ReconnectTimer *reconnectTimer = nullptr;
+	int failures = 0;
+};
+
+class EventSourceContext : public IHTTPContext
+{
+public:
+	EventSourceContext(std::shared_ptr<EventSource> source, const std::string &url, const std::string &lastEventId,
+					   struct curl_slist *headers);
+	~EventSourceContext();
+
+public: // IHTTPContext
+	bool InitCurl();
+	void OnCompleted();
+	bool IsFireAndForget();
+	void OnLoopCompleted(CURLcode result);
+
+public:
+	size_t Parse(const char *data, size_t size);
+	bool IsClosed() const { return source->IsClosed(); }
+
+private:
+	bool CheckResponse();
+	void ParseLine();
+	void AppendLine(const char *data, size_t size);
+	void DispatchEvent();
+
+private:
+	std::shared_ptr<EventSource> source;
+	const std::string url;
+	struct curl_slist *headers;
+
+	/* Parser state, see "Interpreting an event stream" */
+	std::string line;
+	std::string eventType;
+	std::string data;
+	std::string idBuffer;
+	bool lastWasCR = false;
+	bool firstChunk = true;
+	bool checkedResponse = false;
+	std::string failure;
+	bool retryFailure = false;
+};
+
+#endif // SM_RIPEXT_EVENTSOURCE_H_
@@ -21,27 +21,45 @@
 
 #include "extension.h"
 #include "httprequest.h"
+#include "httpbatcher.h"
+#include "config.h"
+#include "dispatch.h"
+#include "eventsource.h"
+#include "hedge.h"
+#include "log.h"
 #include "queue.h"
+#include "quota.h"
+#include "retry.h"
+#include "stats.h"
 #include "websocket_connection_base.h"
 #include "websocket_eventloop.h"
+#include <algorithm>
 #include <atomic>
 
-// Limit the max processing request per tick
-#define MAX_PROCESS 10
+#define MAX_FALLBACK_COMPLETIONS 64
 
 RipExt g_RipExt; /**< Global singleton for extension's main interface */
 
 SMEXT_LINK(&g_RipExt);
 
-LockedQueue<IHTTPContext *> g_RequestQueue;
-LockedQueue<IHTTPContext *> g_CompletedRequestQueue;
+/* Critical requests get 8 turns and normal requests 4 turns for every bulk request */
+static const int g_PriorityWeights[RequestPriority_Count] = {8, 4, 1};
+
+PriorityQueue<IHTTPContext *, RequestPriority_Count> g_RequestQueue(g_PriorityWeights);
+PriorityQueue<IHTTPContext *, RequestPriority_Count> g_CompletedRequestQueue(g_PriorityWeights);
+LockedQueue<std::function<void()> *> g_LoopTaskQueue;
 
 CURLM *g_Curl;
 uv_loop_t *g_Loop;
 uv_thread_t g_Thread;
+uv_timer_t g_SampleTimer;
+
+/* Whether the loop is run by the first WebSocket thread instead of g_Thread */
+static bool g_UnifiedLoop = false;
 uv_timer_t g_Timeout;
 
 uv_async_t g_AsyncPerformRequests;
+uv_async_t g_AsyncRunLoopTasks;
 uv_async_t g_AsyncStopLoop;
 
 HTTPRequestHandler g_HTTPRequestHandler;
@@ -50,6 +68,15 @@ HandleType_t htHTTPRequest;
 HTTPResponseHandler g_HTTPResponseHandler;
 HandleType_t htHTTPResponse;
 
+HTTPBatcherHandler g_HTTPBatcherHandler;
+HandleType_t htHTTPBatcher;
+
+HTTPUploadStreamHandler g_HTTPUploadStreamHandler;
+HandleType_t htHTTPUploadStream;
+
+EventSourceHandler g_EventSourceHandler;
+HandleType_t htEventSource;
+
 JSONHandler g_JSONHandler;
 HandleType_t htJSON;
 
@@ -59,7 +86,122 @@ HandleType_t htJSONObjectKeys;
 WebSocketHandler g_WebSocketHandler;
 HandleType_t htWebSocket;
 
-std::atomic<bool> unloaded;
+WebSocketBatchHandler g_WebSocketBatchHandler;
+HandleType_t htWebSocketBatch;
+
+/* Number of bulk transfers admitted into the multi handle, only used on the event loop thread */
+static long g_ActiveBulkTransfers = 0;
+
+/* Requests taken from the queue that have not completed yet, only used on the event loop thread */
+static long g_OpenRequests = 0;
+static uint64_t g_BusySince = 0;
+
+static curl_off_t CapSpeed(curl_off_t speed, curl_off_t cap)
+{
+	if (cap <= 0)
+	{
+		return speed;
+	}
+
+	return (speed > 0) ? std::min(speed, cap) : cap;
+}
+
+void IHTTPContext::SetSpeedLimits(curl_off_t maxRecvSpeed, curl_off_t maxSendSpeed)
+{
+	if (priority == RequestPriority_Bulk)
+	{
+		maxRecvSpeed = CapSpeed(maxRecvSpeed, g_Config.GetOption(HTTPOption_BulkMaxRecvSpeed));
+		maxSendSpeed = CapSpeed(maxSendSpeed, g_Config.GetOption(HTTPOption_BulkMaxSendSpeed));
+	}
+
+	if (maxRecvSpeed > 0)
+	{
+		curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, maxRecvSpeed);
+	}
+	if (maxSendSpeed > 0)
+	{
+		curl_easy_setopt(curl, CURLOPT_MAX_SEND_SPEED_LARGE, maxSendSpeed);
+	}
+}
+
+static void AdmitTransfer(IHTTPContext *context)
+{
+	context->admitted = true;
+
+	if (context->priority == RequestPriority_Bulk)
+	{
+		g_ActiveBulkTransfers++;
+	}
+	if (context->owner)
+	{
+		g_PluginQuotas.OnAdmitted(context->owner.get());
+	}
+}
+
+static void ReleaseTransfer(IHTTPContext *context)
+{
+	if (!context->admitted)
+	{
+		return;
+	}
+
+	context->admitted = false;
+	bool freedSlot = false;
+
+	if (context->priority == RequestPriority_Bulk && g_ActiveBulkTransfers-- == g_Config.GetOption(HTTPOption_MaxBulkTransfers))
+	{
+		freedSlot = true;
+	}
+	if (context->owner && g_PluginQuotas.OnFinished(context->owner.get()))
+	{
+		freedSlot = true;
+	}
+
+	/* Requests may have been waiting in the queue for this slot */
+	if (freedSlot)
+	{
+		uv_async_send(&g_AsyncPerformRequests);
+	}
+}
+
+static void OpenRequest()
+{
+	if (g_OpenRequests++ == 0)
+	{
+		g_BusySince = uv_hrtime();
+	}
+}
+
+static void CloseRequest()
+{
+	/* Measured here rather than on the game thread, which only sees completions once per frame */
+	if (--g_OpenRequests == 0)
+	{
+		g_Stats.http.busyTime += (uv_hrtime() - g_BusySince) / 1000;
+	}
+}
+
+static void CompleteRequest(IHTTPContext *context, CURLcode result)
+{
+	CloseRequest();
+
+	g_Stats.RecordTransfer(context, result);
+
+	ReleaseTransfer(context);
+
+	context->OnLoopCompleted(result);
+
+	/* Nobody is waiting for the response, so skip the game thread entirely */
+	if (context->IsFireAndForget())
+	{
+		delete context;
+		return;
+	}
+
+	g_CompletedRequestQueue.Lock();
+	g_CompletedRequestQueue.Push(context, context->priority, context->owner.get());
+	g_CompletedRequestQueue.Unlock();
+}
 
 static void CheckCompletedRequests()
 {
@@ -79,9 +221,27 @@ static void CheckCompletedRequests()
 		IHTTPContext *context;
 		curl_easy_getinfo(curl, CURLINFO_PRIVATE, &context);
 
-		g_CompletedRequestQueue.Lock();
-		g_CompletedRequestQueue.Push(context);
-		g_CompletedRequestQueue.Unlock();
+		CURLcode result = message->data.result;
+		g_HedgeManager.RecordLatency(context, result);
+
+		/* The first hedged transfer to finish wins, the other one is dropped */
+		if (context->hedge != nullptr && (context = g_HedgeManager.OnTransferDone(context, result)) == nullptr)
+		{
+			continue;
+		}
+
+		if (g_RetryManager.ScheduleRetry(context, result))
+		{
+			continue;
+		}
+
+		/* Downloads finish writing to disk before they complete */
+		if (context->DeferCompletion(result))
+		{
+			continue;
+		}
+
+		CompleteRequest(context, result);
 	}
 }
 
@@ -168,8 +328,18 @@ static int CurlTimeoutCallback(CURLM *multi, long timeout_ms, void *userdata)
 	return 0;
 }
 
+static void SampleThread(uv_timer_t *handle)
+{
+	static ThreadSample last;
+	g_Stats.RecordThread(g_Stats.httpThread, last);
+}
+
 static void EventLoop(void *data)
 {
+	/* In the unified loop the WebSocket thread records its own usage instead */
+	uv_timer_init(g_Loop, &g_SampleTimer);
+	uv_timer_start(&g_SampleTimer, &SampleThread, SM_RIPEXT_THREAD_SAMPLE_INTERVAL, SM_RIPEXT_THREAD_SAMPLE_INTERVAL);
+
 	uv_run(g_Loop, UV_RUN_DEFAULT);
 }
 
@@ -177,50 +347,133 @@ static void AsyncPerformRequests(uv_async_t *handle)
 {
 	g_RequestQueue.Lock();
 	IHTTPContext *context;
-	// Limiter
 	int count = 0;
 
-	while (!g_RequestQueue.Empty() && count < MAX_PROCESS)
+	long maxStarts = g_Config.GetOption(HTTPOption_MaxStartsPerWakeup);
+	long maxBulkTransfers = g_Config.GetOption(HTTPOption_MaxBulkTransfers);
+
+	for (;;)
 	{
-		context = g_RequestQueue.Pop();
+		/* Bulk requests wait in the queue while too many bulk transfers are running */
+		g_RequestQueue.SetPaused(RequestPriority_Bulk, maxBulkTransfers > 0 && g_ActiveBulkTransfers >= maxBulkTransfers);
+
+		/* Let the loop run between groups of starts, the rest follow on the next iteration */
+		if (maxStarts > 0 && count >= maxStarts)
+		{
+			uv_async_send(&g_AsyncPerformRequests);
+			break;
+		}
+
+		/* Plugins at their in-flight quota are skipped, the others take turns */
+		if (!g_RequestQueue.Pop(context, [](const void *owner) {
+				return g_PluginQuotas.IsBlocked(static_cast<const PluginUsage *>(owner));
+			}))
+		{
+			break;
+		}
+
+		OpenRequest();
+
+		if (!context->rejected)
+		{
+			AdmitTransfer(context);
+		}
 
 		if (!context->InitCurl())
 		{
+			ReleaseTransfer(context);
+			CloseRequest();
 			delete context;
 			continue;
 		}
 
+		/* The plugin already had too many requests queued */
+		if (context->rejected)
+		{
+			snprintf(context->error, sizeof(context->error), "Request quota exceeded for plugin %s", context->owner->name.c_str());
+			CompleteRequest(context, CURLE_ABORTED_BY_CALLBACK);
+			continue;
+		}
+
+		if (context->initResult != CURLE_OK)
+		{
+			CompleteRequest(context, context->initResult);
+			continue;
+		}
+
+		/* Fail fast while the circuit breaker for this host is open */
+		if (!g_RetryManager.AllowRequest(context))
+		{
+			CompleteRequest(context, CURLE_COULDNT_CONNECT);
+			continue;
+		}
+
 		curl_multi_add_handle(g_Curl, context->curl);
 		count++;
+
+		if (context->hedgePolicy.enabled)
+		{
+			g_HedgeManager.Start(context);
+		}
 	}
 
 	g_RequestQueue.Unlock();
 }
 
+static void AsyncRunLoopTasks(uv_async_t *handle)
+{
+	g_LoopTaskQueue.Lock();
+
+	while (!g_LoopTaskQueue.Empty())
+	{
+		std::unique_ptr<std::function<void()>> task(g_LoopTaskQueue.Pop());
+
+		/* Tasks may queue further tasks */
+		g_LoopTaskQueue.Unlock();
+		task->operator()();
+		g_LoopTaskQueue.Lock();
+	}
+
+	g_LoopTaskQueue.Unlock();
+}
+
 static void AsyncStopLoop(uv_async_t *handle)
 {
 	uv_stop(g_Loop);
 }
 
-static void FrameHook(bool simulating)
+static void DispatchCompletions(bool fallback)
 {
+	g_Logger.Flush();
+
 	if (!g_RequestQueue.Empty())
 	{
 		uv_async_send(&g_AsyncPerformRequests);
 	}
 
-	if (!g_CompletedRequestQueue.Empty())
+	/* A hibernating server thinks much less often than it runs game frames, so the fallback handles more at once */
+	int count = fallback ? MAX_FALLBACK_COMPLETIONS : 1;
+
+	while (count-- > 0 && !g_CompletedRequestQueue.Empty())
 	{
 		g_CompletedRequestQueue.Lock();
-		IHTTPContext *context = g_CompletedRequestQueue.Pop();
 
-		context->OnCompleted();
-		delete context;
+		IHTTPContext *context;
+		if (g_CompletedRequestQueue.Pop(context))
+		{
+			context->OnCompleted();
+			delete context;
+		}
 
 		g_CompletedRequestQueue.Unlock();
 	}
 }
 
+static void FrameHook(bool simulating)
+{
+	g_Dispatcher.OnGameFrame();
+}
+
 bool RipExt::SDK_OnLoad(char *error, size_t maxlength, bool late)
 {
 	sharesys->AddNatives(myself, http_natives);
@@ -241,12 +494,17 @@ bool RipExt::SDK_OnLoad(char *error, size_t maxlength, bool late)
 	curl_multi_setopt(g_Curl, CURLMOPT_SOCKETFUNCTION, &CurlSocketCallback);
 	curl_multi_setopt(g_Curl, CURLMOPT_TIMERFUNCTION, &CurlTimeoutCallback);
 
+	/* The loop thread is not running yet, so the options can be applied directly */
+	g_Config.Load();
+	g_Config.ApplyMultiOptions(g_Curl);
+	g_Logger.Init();
+
 	/* Initialize libuv */
 	g_Loop = uv_default_loop();
 	uv_timer_init(g_Loop, &g_Timeout);
 	uv_async_init(g_Loop, &g_AsyncPerformRequests, &AsyncPerformRequests);
+	uv_async_init(g_Loop, &g_AsyncRunLoopTasks, &AsyncRunLoopTasks);
 	uv_async_init(g_Loop, &g_AsyncStopLoop, &AsyncStopLoop);
-	uv_thread_create(&g_Thread, &EventLoop, nullptr);
 
 	/* Set up access rights for the 'HTTPRequest' handle type */
 	HandleAccess haHTTPRequest;
@@ -273,26 +531,57 @@ bool RipExt::SDK_OnLoad(char *error, size_t maxlength, bool late)
 	taWS.access[HTypeAccess_Create] = true;
 	taWS.access[HTypeAccess_Inherit] = true;
 
+	/* Set up access rights for the 'WebSocketBatch' handle type, only we free it after the callback */
+	HandleAccess haWSBatch;
+	handlesys->InitAccessDefaults(nullptr, &haWSBatch);
+	haWSBatch.access[HandleAccess_Clone] = HANDLE_RESTRICT_IDENTITY;
+	haWSBatch.access[HandleAccess_Delete] = HANDLE_RESTRICT_IDENTITY;
+
 	htHTTPRequest = handlesys->CreateType("HTTPRequest", &g_HTTPRequestHandler, 0, nullptr, &haHTTPRequest, myself->GetIdentity(), nullptr);
 	htHTTPResponse = handlesys->CreateType("HTTPResponse", &g_HTTPResponseHandler, 0, nullptr, &haHTTPResponse, myself->GetIdentity(), nullptr);
+	htHTTPBatcher = handlesys->CreateType("HTTPBatcher", &g_HTTPBatcherHandler, 0, nullptr, nullptr, myself->GetIdentity(), nullptr);
+	htHTTPUploadStream = handlesys->CreateType("HTTPUploadStream", &g_HTTPUploadStreamHandler, 0, nullptr, nullptr, myself->GetIdentity(), nullptr);
+	htEventSource = handlesys->CreateType("EventSource", &g_EventSourceHandler, 0, nullptr, nullptr, myself->GetIdentity(), nullptr);
 	htJSON = handlesys->CreateType("JSON", &g_JSONHandler, 0, nullptr, &haJSON, myself->GetIdentity(), nullptr);
 	htJSONObjectKeys = handlesys->CreateType("JSONObjectKeys", &g_JSONObjectKeysHandler, 0, nullptr, nullptr, myself->GetIdentity(), nullptr);
 	htWebSocket = handlesys->CreateType("WebSocket", &g_WebSocketHandler, 0, &taWS, &haWS, myself->GetIdentity(), nullptr);
+	htWebSocketBatch = handlesys->CreateType("WebSocketBatch", &g_WebSocketBatchHandler, 0, nullptr, &haWSBatch, myself->GetIdentity(), nullptr);
 
 	smutils->AddGameFrameHook(&FrameHook);
+	g_Dispatcher.Init(&DispatchCompletions);
+	g_PluginQuotas.Init();
+	rootconsole->AddRootConsoleCommand3("ripext", "REST in Pawn", this);
 	smutils->BuildPath(Path_SM, caBundlePath, sizeof(caBundlePath), SM_RIPEXT_CA_BUNDLE_PATH);
 
 	event_loop.OnExtLoad();
 
-	unloaded.store(false);
+	/* One thread waiting for both HTTP and WebSocket events saves a thread and its wakeups */
+	g_UnifiedLoop = g_Config.GetUnifiedLoop() && event_loop.attach_uv_loop(g_Loop);
+	g_Stats.unifiedLoop = g_UnifiedLoop;
+	if (!g_UnifiedLoop)
+	{
+		if (g_Config.GetUnifiedLoop())
+		{
+			g_RipExt.LogError("The unified loop is not supported on this platform, HTTP transfers run on a thread of their own");
+		}
+
+		uv_thread_create(&g_Thread, &EventLoop, nullptr);
+	}
 
 	return true;
 }
 
 void RipExt::SDK_OnUnload()
 {
-	uv_async_send(&g_AsyncStopLoop);
-	uv_thread_join(&g_Thread);
+	if (g_UnifiedLoop)
+	{
+		event_loop.detach_uv_loop();
+	}
+	else
+	{
+		uv_async_send(&g_AsyncStopLoop);
+		uv_thread_join(&g_Thread);
+	}
 	uv_loop_close(g_Loop);
 
 	curl_multi_cleanup(&g_Curl);
@@ -300,74 +589,94 @@ void RipExt::SDK_OnUnload()
 
 	handlesys->RemoveType(htHTTPRequest, myself->GetIdentity());
 	handlesys->RemoveType(htHTTPResponse, myself->GetIdentity());
+	handlesys->RemoveType(htHTTPBatcher, myself->GetIdentity());
+	handlesys->RemoveType(htHTTPUploadStream, myself->GetIdentity());
+	handlesys->RemoveType(htEventSource, myself->GetIdentity());
 	handlesys->RemoveType(htJSON, myself->GetIdentity());
 	handlesys->RemoveType(htJSONObjectKeys, myself->GetIdentity());
 	handlesys->RemoveType(htWebSocket, myself->GetIdentity());
+	handlesys->RemoveType(htWebSocketBatch, myself->GetIdentity());
 
 	smutils->RemoveGameFrameHook(&FrameHook);
+	g_Dispatcher.Shutdown();
+	g_PluginQuotas.Shutdown();
+	rootconsole->RemoveRootConsoleCommand("ripext", this);
 
 	event_loop.OnExtUnload();
+	g_Logger.Shutdown();
+}
 
-	unloaded.store(true);
+bool RipExt::SDK_OnMetamodLoad(ISmmAPI *ismm, char *error, size_t maxlength, bool late)
+{
+	/* The dispatcher hooks the game while it hibernates, see Dispatcher::Init */
+	g_Dispatcher.FindGameDLL(ismm->GetServerFactory(false));
+
+	return true;
 }
 
 void RipExt::AddRequestToQueue(IHTTPContext *context)
 {
+	context->queuedTime = uv_hrtime();
+
 	g_RequestQueue.Lock();
-	g_RequestQueue.Push(context);
+	g_RequestQueue.Push(context, context->priority, context->owner.get());
 	g_RequestQueue.Unlock();
+
+	g_Stats.http.queued++;
+
+	/* Start the request right away instead of on the next frame */
+	uv_async_send(&g_AsyncPerformRequests);
 }
 
-void log_msg(void *msg)
+void RipExt::CompleteRequest(IHTTPContext *context, CURLcode result)
 {
-	if (!unloaded.load())
-	{
-		smutils->LogMessage(myself, reinterpret_cast<char *>(msg));
-	}
-	free(msg);
+	::CompleteRequest(context, result);
+}
+
+void RipExt::RunOnLoop(std::function<void()> task)
+{
+	g_LoopTaskQueue.Lock();
+	g_LoopTaskQueue.Push(new std::function<void()>(std::move(task)));
+	g_LoopTaskQueue.Unlock();
+
+	uv_async_send(&g_AsyncRunLoopTasks);
 }
 
-void log_err(void *msg)
+void RipExt::OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args)
 {
-	if (!unloaded.load())
+	if (args->ArgC() >= 3 && strcmp(args->Arg(2), "stats") == 0)
 	{
-		smutils->LogError(myself, reinterpret_cast<char *>(msg));
+		g_Stats.Print();
+		g_PluginQuotas.Print();
+		return;
 	}
-	free(msg);
+
+	rootconsole->ConsolePrint("REST in Pawn Menu:");
+	rootconsole->DrawGenericOption("stats", "Show HTTP and WebSocket statistics");
 }
 
 void RipExt::LogMessage(const char *msg, ...)
 {
-	char *buffer = reinterpret_cast<char *>(malloc(3072));
 	va_list vp;
 	va_start(vp, msg);
-	vsnprintf(buffer, 3072, msg, vp);
+	g_Logger.Log(LogLevel_Info, msg, vp);
 	va_end(vp);
-
-	smutils->AddFrameAction(&log_msg, reinterpret_cast<void *>(buffer));
 }
 
 void RipExt::LogError(const char *msg, ...)
 {
-	char *buffer = reinterpret_cast<char *>(malloc(3072));
 	va_list vp;
 	va_start(vp, msg);
-	vsnprintf(buffer, 3072, msg, vp);
+	g_Logger.Log(LogLevel_Error, msg, vp);
 	va_end(vp);
-
-	smutils->AddFrameAction(&log_err, reinterpret_cast<void *>(buffer));
 }
 
-void execute_cb(void *cb)
+void RipExt::LogDebug(const char *msg, ...)
 {
-	std::unique_ptr<std::function<void()>> callback(reinterpret_cast<std::function<void()> *>(cb));
-	callback->operator()();
-}
-
-void RipExt::Defer(std::function<void()> callback)
-{
-	std::unique_ptr<std::function<void()>> cb = std::make_unique<std::function<void()>>(callback);
-	smutils->AddFrameAction(&execute_cb, cb.release());
+	va_list vp;
+	va_start(vp, msg);
+	g_Logger.Log(LogLevel_Debug, msg, vp);
+	va_end(vp);
 }
 
 void HTTPRequestHandler::OnHandleDestroy(HandleType_t type, void *object)
@@ -380,6 +689,28 @@ void HTTPResponseHandler::OnHandleDestroy(HandleType_t type, void *object)
 	/* Response objects are automatically cleaned up */
 }
 
+void HTTPBatcherHandler::OnHandleDestroy(HandleType_t type, void *object)
+{
+	/* The batcher flushes what it has left and deletes itself on the event loop thread */
+	((HTTPBatcher *)object)->Close();
+}
+
+void HTTPUploadStreamHandler::OnHandleDestroy(HandleType_t type, void *object)
+{
+	/* Closing the handle ends the request body */
+	std::shared_ptr<UploadStream> *stream = (std::shared_ptr<UploadStream> *)object;
+	(*stream)->Finish();
+	delete stream;
+}
+
+void EventSourceHandler::OnHandleDestroy(HandleType_t type, void *object)
+{
+	/* The stream is aborted on the event loop, and the source is freed with its last transfer */
+	std::shared_ptr<EventSource> *source = (std::shared_ptr<EventSource> *)object;
+	(*source)->Close();
+	delete source;
+}
+
 void JSONHandler::OnHandleDestroy(HandleType_t type, void *object)
 {
 	json_decref((json_t *)object);
@@ -400,3 +731,8 @@ bool WebSocketHandler::GetHandleApproxSize(HandleType_t type, void *object, unsi
 	*size = sizeof(websocket_connection_base);
 	return true;
 }
+
+void WebSocketBatchHandler::OnHandleDestroy(HandleType_t type, void *object)
+{
+	/* Nothing to do, the batch belongs to the connection's inbox */
+}
@@ -33,14 +33,56 @@
 #include "smsdk_ext.h"
 #include <memory>
 #include <functional>
+#include <vector>
 
 #define SM_RIPEXT_CA_BUNDLE_PATH "configs/ripext/ca-bundle.crt"
 #define SM_RIPEXT_USER_AGENT "sm-ripext/" SMEXT_CONF_VERSION
 
+/* Larger upload buffers let libcurl send large bodies at full speed */
+#define SM_RIPEXT_UPLOAD_BUFFER_SIZE (512L * 1024L)
+
 extern uv_loop_t *g_Loop;
+extern CURLM *g_Curl;
 
 typedef StringHashMap<std::string> HTTPHeaderMap;
 
+enum RetryOn
+{
+	RetryOn_Connect = (1 << 0),		/* DNS and connect failures */
+	RetryOn_Timeout = (1 << 1),		/* Transfer timed out */
+	RetryOn_Transfer = (1 << 2),	/* Connection dropped mid-transfer */
+};
+
+struct RetryPolicy
+{
+	int maxAttempts = 1;
+	int baseDelay = 250;
+	int maxDelay = 30000;
+	int retryOn = RetryOn_Connect | RetryOn_Timeout | RetryOn_Transfer;
+	std::vector<long> statuses = {408, 429, 500, 502, 503, 504};
+
+	bool Enabled() const { return maxAttempts > 1; }
+};
+
+enum RequestPriority
+{
+	RequestPriority_Critical = 0,
+	RequestPriority_Normal,
+	RequestPriority_Bulk,
+
+	RequestPriority_Count
+};
+
+struct HedgePolicy
+{
+	bool enabled = false;
+	int delay = 0;
+	std::string alternateUrl;
+};
+
+struct HedgeState;
+struct PluginUsage;
+
 class IHTTPContext
 {
 public:
@@ -48,7 +90,49 @@ public:
 	virtual void OnCompleted() = 0;
 	virtual ~IHTTPContext() {}
 
+	/* Fire-and-forget contexts are cleaned up on the event loop thread without a callback */
+	virtual bool IsFireAndForget() { return false; }
+
+	/* Called on the event loop thread once the transfer is done, before the context is handed to the game thread */
+	virtual void OnLoopCompleted(CURLcode result) {}
+
+	/* Clears the response of a failed attempt before the transfer is retried */
+	virtual void ResetForRetry() {}
+
+	/* Returns true to hold back the completion, the context completes itself later with RipExt::CompleteRequest */
+	virtual bool DeferCompletion(CURLcode result) { return false; }
+
+	/* Hedging starts an identical transfer, and the winner takes over the callback */
+	virtual IHTTPContext *CloneForHedge(const std::string &url) { return nullptr; }
+	virtual void TakeCallback(IHTTPContext *other) {}
+
+	/* Sets the speed limits of the transfer, bulk transfers are capped by the global limits */
+	void SetSpeedLimits(curl_off_t maxRecvSpeed, curl_off_t maxSendSpeed);
+
 	CURL *curl;
+	char error[CURL_ERROR_SIZE] = {'\0'};
+
+	RetryPolicy retryPolicy;
+	std::string host;
+	int attempt = 1;
+	long httpVersion = CURL_HTTP_VERSION_NONE;
+	/* The version the plugin asked for, httpVersion has the per-host config applied */
+	long requestedVersion = CURL_HTTP_VERSION_NONE;
+	RequestPriority priority = RequestPriority_Normal;
+
+	/* The plugin that made the request, and whether it holds one of the plugin's transfer slots */
+	std::shared_ptr<PluginUsage> owner;
+	bool admitted = false;
+	bool rejected = false;
+
+	/* Set by InitCurl when the request cannot run, it completes with this result and the message in error */
+	CURLcode initResult = CURLE_OK;
+
+	HedgePolicy hedgePolicy;
+	HedgeState *hedge = nullptr;
+
+	/* uv_hrtime() when the request was queued, for the latency stats */
+	uint64_t queuedTime = 0;
 };
 
 struct CurlContext
@@ -108,7 +192,7 @@ private:
  * @brief Implementation of the REST in Pawn Extension.
  * Note: Uncomment one of the pre-defined virtual functions in order to use it.
  */
-class RipExt : public SDKExtension
+class RipExt : public SDKExtension, public IRootConsoleCommand
 {
 public:
 	/**
@@ -147,7 +231,7 @@ public:
 	// virtual bool QueryRunning(char *error, size_t maxlength);
 	virtual void LogMessage(const char *msg, ...);
 	virtual void LogError(const char *msg, ...);
-	virtual void Defer(std::function<void()> callback);
+	virtual void LogDebug(const char *msg, ...);
 
 public:
 #if defined SMEXT_CONF_METAMOD
@@ -159,7 +243,7 @@ public:
 	 * @param late			Whether or not Metamod considers this a late load.
 	 * @return				True to succeed, false to fail.
 	 */
-	// virtual bool SDK_OnMetamodLoad(ISmmAPI *ismm, char *error, size_t maxlength, bool late);
+	virtual bool SDK_OnMetamodLoad(ISmmAPI *ismm, char *error, size_t maxlength, bool late);
 
 	/**
 	 * @brief Called when Metamod is detaching, after the extension version is called.
@@ -182,8 +266,13 @@ public:
 	 */
 	// virtual bool SDK_OnMetamodPauseChange(bool paused, char *error, size_t maxlength);
 #endif
+public: // IRootConsoleCommand
+	void OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args);
+
 public:
 	void AddRequestToQueue(IHTTPContext *context);
+	void CompleteRequest(IHTTPContext *context, CURLcode result);
+	void RunOnLoop(std::function<void()> task);
 
 	char caBundlePath[PLATFORM_MAX_PATH];
 };
@@ -200,6 +289,24 @@ public:
 	void OnHandleDestroy(HandleType_t type, void *object);
 };
 
+class HTTPBatcherHandler : public IHandleTypeDispatch
+{
+public:
+	void OnHandleDestroy(HandleType_t type, void *object);
+};
+
+class HTTPUploadStreamHandler : public IHandleTypeDispatch
+{
+public:
+	void OnHandleDestroy(HandleType_t type, void *object);
+};
+
+class EventSourceHandler : public IHandleTypeDispatch
+{
+public:
+	void OnHandleDestroy(HandleType_t type, void *object);
+};
+
 class JSONHandler : public IHandleTypeDispatch
 {
 public:
@@ -219,6 +326,12 @@ public:
 	bool GetHandleApproxSize(HandleType_t type, void *object, unsigned int *size);
 };
 
+class WebSocketBatchHandler : public IHandleTypeDispatch
+{
+public:
+	void OnHandleDestroy(HandleType_t type, void *object);
+};
+
 extern RipExt g_RipExt;
 
 extern HTTPRequestHandler g_HTTPRequestHandler;
@@ -227,6 +340,15 @@ extern HandleType_t htHTTPRequest;
 extern HTTPResponseHandler g_HTTPResponseHandler;
 extern HandleType_t htHTTPResponse;
 
+extern HTTPBatcherHandler g_HTTPBatcherHandler;
+extern HandleType_t htHTTPBatcher;
+
+extern HTTPUploadStreamHandler g_HTTPUploadStreamHandler;
+extern HandleType_t htHTTPUploadStream;
+
+extern EventSourceHandler g_EventSourceHandler;
+extern HandleType_t htEventSource;
+
 extern JSONHandler g_JSONHandler;
 extern HandleType_t htJSON;
 
@@ -236,6 +358,9 @@ extern HandleType_t htJSONObjectKeys;
 extern WebSocketHandler g_WebSocketHandler;
 extern HandleType_t htWebSocket;
 
+extern WebSocketBatchHandler g_WebSocketBatchHandler;
+extern HandleType_t htWebSocketBatch;
+
 extern const sp_nativeinfo_t http_natives[];
 extern const sp_nativeinfo_t json_natives[];
 extern const sp_nativeinfo_t websocket_natives[];
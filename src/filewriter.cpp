@@ -0,0 +1,328 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filewriter.h"
+#include <fcntl.h>
+#ifdef WIN32
+#include <malloc.h>
+#endif
+
+/* Aligned to the page size, which suits direct and buffered I/O alike */
+#define BLOCK_ALIGNMENT 4096
+
+static char *AllocateBlock()
+{
+#ifdef WIN32
+	return (char *)_aligned_malloc(FILEWRITER_BLOCK_SIZE, BLOCK_ALIGNMENT);
+#else
+	void *data;
+	return (posix_memalign(&data, BLOCK_ALIGNMENT, FILEWRITER_BLOCK_SIZE) == 0) ? (char *)data : nullptr;
+#endif
+}
+
+static void FreeBlock(char *data)
+{
+#ifdef WIN32
+	_aligned_free(data);
+#else
+	free(data);
+#endif
+}
+
+FileWriter::FileWriter(CURL *curl)
+	: curl(curl)
+{
+	preallocate.data = this;
+	control.data = this;
+}
+
+FileWriter::~FileWriter()
+{
+	if (current != nullptr)
+	{
+		spare.push_back(current);
+	}
+	for (Block *block : pending)
+	{
+		spare.push_back(block);
+	}
+
+	for (Block *block : spare)
+	{
+		if (block->data != nullptr)
+		{
+			FreeBlock(block->data);
+		}
+		delete block;
+	}
+
+	/* Only reached without Finish when the transfer never started */
+	if (fd >= 0)
+	{
+		uv_fs_t req;
+		uv_fs_close(nullptr, &req, fd, nullptr);
+		uv_fs_req_cleanup(&req);
+	}
+}
+
+bool FileWriter::Open(const char *path)
+{
+	uv_fs_t req;
+	fd = uv_fs_open(nullptr, &req, path, O_WRONLY | O_CREAT | O_TRUNC, 0644, nullptr);
+	uv_fs_req_cleanup(&req);
+
+	if (fd < 0)
+	{
+		error = fd;
+		return false;
+	}
+
+	return true;
+}
+
+size_t FileWriter::Write(const char *data, size_t size)
+{
+	/* A failed write aborts the transfer */
+	if (error != 0)
+	{
+		return 0;
+	}
+
+	/* Make sure the whole chunk fits before taking any of it, a paused chunk is delivered again later */
+	size_t room = (current != nullptr) ? FILEWRITER_BLOCK_SIZE - current->size : 0;
+	if (size > room)
+	{
+		size_t blocksNeeded = (size - room + FILEWRITER_BLOCK_SIZE - 1) / FILEWRITER_BLOCK_SIZE;
+		size_t blocksFree = spare.size() + (FILEWRITER_MAX_BLOCKS - allocated);
+
+		if (blocksNeeded > blocksFree)
+		{
+			paused = true;
+			return CURL_WRITEFUNC_PAUSE;
+		}
+	}
+
+	size_t remaining = size;
+	while (remaining > 0)
+	{
+		if (current == nullptr)
+		{
+			current = TakeBlock();
+			if (current->data == nullptr)
+			{
+				error = UV_ENOMEM;
+				return 0;
+			}
+		}
+
+		size_t length = std::min(remaining, FILEWRITER_BLOCK_SIZE - current->size);
+		memcpy(&current->data[current->size], data, length);
+		current->size += length;
+		data += length;
+		remaining -= length;
+
+		if (current->size == FILEWRITER_BLOCK_SIZE)
+		{
+			pending.push_back(current);
+			current = nullptr;
+		}
+	}
+
+	Submit();
+
+	return size;
+}
+
+void FileWriter::Preallocate(int64_t size)
+{
+	preallocateSize = size;
+	Submit();
+}
+
+void FileWriter::Reset()
+{
+	/* The block being written finishes first, and everything after it starts at offset 0 again */
+	if (current != nullptr)
+	{
+		pending.push_back(current);
+		current = nullptr;
+	}
+
+	while (!pending.empty())
+	{
+		Block *block = pending.front();
+		pending.pop_front();
+
+		block->size = 0;
+		spare.push_back(block);
+	}
+
+	offset = 0;
+	preallocateSize = 0;
+}
+
+void FileWriter::Finish(std::function<void()> callback)
+{
+	finishCallback = std::move(callback);
+	finishing = true;
+
+	if (current != nullptr)
+	{
+		pending.push_back(current);
+		current = nullptr;
+	}
+
+	Submit();
+}
+
+FileWriter::Block *FileWriter::TakeBlock()
+{
+	if (!spare.empty())
+	{
+		Block *block = spare.back();
+		spare.pop_back();
+		return block;
+	}
+
+	Block *block = new Block;
+	block->data = AllocateBlock();
+	block->size = 0;
+	block->writer = this;
+	block->req.data = block;
+	allocated++;
+
+	return block;
+}
+
+void FileWriter::Submit()
+{
+	if (busy)
+	{
+		return;
+	}
+
+	if (preallocateSize > 0)
+	{
+		preallocating = preallocateSize;
+		preallocateSize = 0;
+
+		busy = true;
+		uv_queue_work(g_Loop, &preallocate, &OnPreallocate, &OnPreallocated);
+		return;
+	}
+
+	if (!pending.empty())
+	{
+		Block *block = pending.front();
+		pending.pop_front();
+
+		busy = true;
+
+		uv_buf_t buf = uv_buf_init(block->data, (unsigned int)block->size);
+		uv_fs_write(g_Loop, &block->req, fd, &buf, 1, offset, &OnWritten);
+
+		offset += block->size;
+		return;
+	}
+
+	if (finishing)
+	{
+		finishing = false;
+		busy = true;
+
+		/* Drop whatever was preallocated beyond the end of the download */
+		uv_fs_ftruncate(g_Loop, &control, fd, offset, &OnTruncated);
+	}
+}
+
+void FileWriter::OnWritten(uv_fs_t *req)
+{
+	Block *block = (Block *)req->data;
+	FileWriter *writer = block->writer;
+
+	if (req->result < 0 && writer->error == 0)
+	{
+		writer->error = (int)req->result;
+	}
+
+	uv_fs_req_cleanup(req);
+
+	block->size = 0;
+	writer->spare.push_back(block);
+	writer->busy = false;
+
+	/* A block is free again, so the transfer can carry on */
+	if (writer->paused)
+	{
+		writer->paused = false;
+		curl_easy_pause(writer->curl, CURLPAUSE_CONT);
+	}
+
+	writer->Submit();
+}
+
+void FileWriter::OnPreallocate(uv_work_t *req)
+{
+	FileWriter *writer = (FileWriter *)req->data;
+
+#if defined __linux__
+	/* Only a hint, the download works without it */
+	posix_fallocate(writer->fd, 0, writer->preallocating);
+#endif
+}
+
+void FileWriter::OnPreallocated(uv_work_t *req, int status)
+{
+	FileWriter *writer = (FileWriter *)req->data;
+
+	writer->busy = false;
+	writer->Submit();
+}
+
+void FileWriter::OnTruncated(uv_fs_t *req)
+{
+	FileWriter *writer = (FileWriter *)req->data;
+
+	if (req->result < 0 && writer->error == 0)
+	{
+		writer->error = (int)req->result;
+	}
+
+	uv_fs_req_cleanup(req);
+
+	uv_fs_close(g_Loop, &writer->control, writer->fd, &OnClosed);
+	writer->fd = -1;
+}
+
+void FileWriter::OnClosed(uv_fs_t *req)
+{
+	FileWriter *writer = (FileWriter *)req->data;
+
+	if (req->result < 0 && writer->error == 0)
+	{
+		writer->error = (int)req->result;
+	}
+
+	uv_fs_req_cleanup(req);
+
+	writer->busy = false;
+	writer->finishCallback();
+}
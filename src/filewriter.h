@@ -0,0 +1,107 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_FILEWRITER_H_
+#define SM_RIPEXT_FILEWRITER_H_
+
+#include "extension.h"
+#include <deque>
+
+/* Downloads are staged in blocks of this size before they are written to disk */
+#define FILEWRITER_BLOCK_SIZE (1024 * 1024)
+#define FILEWRITER_MAX_BLOCKS 4
+
+/*
+ * Writes a download to disk on the libuv threadpool, so a slow disk does not
+ * stall the event loop. Data is staged in large aligned blocks, and blocks
+ * are written one at a time in order. When every block is waiting for the
+ * disk, the transfer is paused until one is free again.
+ *
+ * All functions must be called on the event loop thread.
+ */
+class FileWriter
+{
+public:
+	FileWriter(CURL *curl);
+	~FileWriter();
+
+	bool Open(const char *path);
+
+	/* CURLOPT_WRITEFUNCTION compatible, returns CURL_WRITEFUNC_PAUSE when the disk is behind */
+	size_t Write(const char *data, size_t size);
+
+	/* Reserves disk space for the expected size of the download */
+	void Preallocate(int64_t size);
+
+	/* Starts over at the beginning of the file, for retries */
+	void Reset();
+
+	/* Writes out the remaining data, truncates the file to its final size and closes it */
+	void Finish(std::function<void()> callback);
+
+	bool Failed() const { return error != 0; }
+	const char *GetError() const { return uv_strerror(error); }
+
+private:
+	struct Block
+	{
+		uv_fs_t req;
+		char *data;
+		size_t size;
+		FileWriter *writer;
+	};
+
+	Block *TakeBlock();
+	void Submit();
+	void Close();
+
+	static void OnWritten(uv_fs_t *req);
+	static void OnPreallocate(uv_work_t *req);
+	static void OnPreallocated(uv_work_t *req, int status);
+	static void OnTruncated(uv_fs_t *req);
+	static void OnClosed(uv_fs_t *req);
+
+private:
+	CURL *curl;
+	uv_file fd = -1;
+	int error = 0;
+
+	Block *current = nullptr;
+	std::deque<Block *> pending;
+	std::vector<Block *> spare;
+	int allocated = 0;
+
+	/* Offset of the next block to be written, which is the size of the file once everything is written */
+	int64_t offset = 0;
+
+	bool busy = false;
+	bool paused = false;
+
+	int64_t preallocateSize = 0;
+	int64_t preallocating = 0;
+	uv_work_t preallocate;
+
+	uv_fs_t control;
+	std::function<void()> finishCallback;
+	bool finishing = false;
+};
+
+#endif // SM_RIPEXT_FILEWRITER_H_
@@ -0,0 +1,175 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hedge.h"
+#include "stats.h"
+#include <algorithm>
+
+HedgeManager g_HedgeManager;
+
+void HedgeManager::Start(IHTTPContext *context)
+{
+	HedgeState *state = new HedgeState;
+	state->primary = context;
+	state->timer.data = state;
+
+	context->hedge = state;
+
+	uv_timer_init(g_Loop, &state->timer);
+	uv_timer_start(&state->timer, &OnHedgeTimer, GetDelay(context), 0);
+
+	g_Stats.http.hedgeEligible++;
+}
+
+IHTTPContext *HedgeManager::OnTransferDone(IHTTPContext *context, CURLcode result)
+{
+	HedgeState *state = context->hedge;
+
+	/* The hedge timer never fired, so there is nothing to race against */
+	if (state->secondary == nullptr)
+	{
+		return Resolve(state, context, nullptr);
+	}
+
+	IHTTPContext *other = (context == state->primary) ? state->secondary : state->primary;
+
+	/* The other transfer already failed and was parked, this one gets the final say */
+	if (other == state->failed)
+	{
+		return Resolve(state, context, other);
+	}
+
+	long status = 0;
+	curl_easy_getinfo(context->curl, CURLINFO_RESPONSE_CODE, &status);
+
+	if (result == CURLE_OK && status < 500)
+	{
+		curl_multi_remove_handle(g_Curl, other->curl);
+		return Resolve(state, context, other);
+	}
+
+	/* Park the failure while the other transfer still has a chance to succeed */
+	state->failed = context;
+	return nullptr;
+}
+
+void HedgeManager::RecordLatency(IHTTPContext *context, CURLcode result)
+{
+	if (result != CURLE_OK || context->host.empty())
+	{
+		return;
+	}
+
+	curl_off_t total = 0;
+	curl_easy_getinfo(context->curl, CURLINFO_TOTAL_TIME_T, &total);
+
+	LatencySamples &latency = latencies[context->host];
+	uint32_t sample = (uint32_t)(total / 1000);
+
+	if (latency.samples.size() < HEDGE_MAX_SAMPLES)
+	{
+		latency.samples.push_back(sample);
+	}
+	else
+	{
+		latency.samples[latency.next] = sample;
+		latency.next = (latency.next + 1) % HEDGE_MAX_SAMPLES;
+	}
+}
+
+uint64_t HedgeManager::GetDelay(IHTTPContext *context)
+{
+	if (context->hedgePolicy.delay > 0)
+	{
+		return context->hedgePolicy.delay;
+	}
+
+	auto iter = latencies.find(context->host);
+	if (iter == latencies.end() || iter->second.samples.size() < HEDGE_MIN_SAMPLES)
+	{
+		return HEDGE_DEFAULT_DELAY;
+	}
+
+	/* Hedge at the observed p95, so only the slowest 5% of requests get a second transfer */
+	std::vector<uint32_t> samples = iter->second.samples;
+	size_t p95 = samples.size() * 95 / 100;
+	std::nth_element(samples.begin(), samples.begin() + p95, samples.end());
+
+	return std::max(samples[p95], (uint32_t)1);
+}
+
+IHTTPContext *HedgeManager::Resolve(HedgeState *state, IHTTPContext *winner, IHTTPContext *loser)
+{
+	if (winner == state->secondary)
+	{
+		winner->TakeCallback(state->primary);
+		g_Stats.http.hedgeWon++;
+
+		/* The winner also takes over the transfer slot of the primary */
+		winner->admitted = state->primary->admitted;
+		state->primary->admitted = false;
+	}
+
+	state->primary->hedge = nullptr;
+	if (state->secondary != nullptr)
+	{
+		state->secondary->hedge = nullptr;
+	}
+
+	delete loser;
+
+	uv_timer_stop(&state->timer);
+	uv_close((uv_handle_t *)&state->timer, &OnTimerClosed);
+
+	return winner;
+}
+
+void HedgeManager::OnHedgeTimer(uv_timer_t *handle)
+{
+	HedgeState *state = (HedgeState *)handle->data;
+	IHTTPContext *primary = state->primary;
+
+	const std::string &url = primary->hedgePolicy.alternateUrl;
+	IHTTPContext *secondary = primary->CloneForHedge(url);
+	if (secondary == nullptr)
+	{
+		return;
+	}
+
+	if (!secondary->InitCurl())
+	{
+		delete secondary;
+		return;
+	}
+
+	secondary->hedge = state;
+	secondary->queuedTime = primary->queuedTime;
+	state->secondary = secondary;
+
+	curl_multi_add_handle(g_Curl, secondary->curl);
+
+	g_Stats.http.hedgeStarted++;
+}
+
+void HedgeManager::OnTimerClosed(uv_handle_t *handle)
+{
+	delete (HedgeState *)handle->data;
+}
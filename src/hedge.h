@@ -0,0 +1,68 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_HEDGE_H_
+#define SM_RIPEXT_HEDGE_H_
+
+#include "extension.h"
+#include <map>
+
+/* Hedge delay used until enough latency samples were collected for a host */
+#define HEDGE_DEFAULT_DELAY 250
+#define HEDGE_MIN_SAMPLES 20
+#define HEDGE_MAX_SAMPLES 128
+
+struct HedgeState
+{
+	uv_timer_t timer;
+	IHTTPContext *primary = nullptr;
+	IHTTPContext *secondary = nullptr;
+	IHTTPContext *failed = nullptr;
+};
+
+class HedgeManager
+{
+public:
+	/* All functions must be called on the event loop thread */
+	void Start(IHTTPContext *context);
+	IHTTPContext *OnTransferDone(IHTTPContext *context, CURLcode result);
+	void RecordLatency(IHTTPContext *context, CURLcode result);
+
+private:
+	uint64_t GetDelay(IHTTPContext *context);
+	IHTTPContext *Resolve(HedgeState *state, IHTTPContext *winner, IHTTPContext *loser);
+
+	static void OnHedgeTimer(uv_timer_t *handle);
+	static void OnTimerClosed(uv_handle_t *handle);
+
+private:
+	struct LatencySamples
+	{
+		std::vector<uint32_t> samples;
+		size_t next = 0;
+	};
+
+	std::map<std::string, LatencySamples> latencies;
+};
+
+extern HedgeManager g_HedgeManager;
+
+#endif // SM_RIPEXT_HEDGE_H_
@@ -21,6 +21,11 @@
 
 #include "extension.h"
 #include "httprequest.h"
+#include "httpbatcher.h"
+#include "eventsource.h"
+#include "config.h"
+#include "quota.h"
+#include "stats.h"
 
 static HTTPRequest *GetRequestFromHandle(IPluginContext *pContext, Handle_t hndl)
 {
@@ -37,6 +42,51 @@ static HTTPRequest *GetRequestFromHandle(IPluginContext *pContext, Handle_t hndl
 	return request;
 }
 
+static UploadStream *GetStreamFromHandle(IPluginContext *pContext, Handle_t hndl)
+{
+	HandleError err;
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+
+	std::shared_ptr<UploadStream> *stream;
+	if ((err = handlesys->ReadHandle(hndl, htHTTPUploadStream, &sec, (void **)&stream)) != HandleError_None)
+	{
+		pContext->ReportError("Invalid HTTPUploadStream handle %x (error %d)", hndl, err);
+		return nullptr;
+	}
+
+	return stream->get();
+}
+
+static EventSource *GetEventSourceFromHandle(IPluginContext *pContext, Handle_t hndl)
+{
+	HandleError err;
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+
+	std::shared_ptr<EventSource> *source;
+	if ((err = handlesys->ReadHandle(hndl, htEventSource, &sec, (void **)&source)) != HandleError_None)
+	{
+		pContext->ReportError("Invalid EventSource handle %x (error %d)", hndl, err);
+		return nullptr;
+	}
+
+	return source->get();
+}
+
+static HTTPBatcher *GetBatcherFromHandle(IPluginContext *pContext, Handle_t hndl)
+{
+	HandleError err;
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+
+	HTTPBatcher *batcher;
+	if ((err = handlesys->ReadHandle(hndl, htHTTPBatcher, &sec, (void **)&batcher)) != HandleError_None)
+	{
+		pContext->ReportError("Invalid HTTPBatcher handle %x (error %d)", hndl, err);
+		return nullptr;
+	}
+
+	return batcher;
+}
+
 static json_t *GetJSONFromHandle(IPluginContext *pContext, Handle_t hndl)
 {
 	HandleError err;
@@ -63,7 +113,7 @@ static cell_t CreateRequest(IPluginContext *pContext, const cell_t *params)
 		return BAD_HANDLE;
 	}
 
-	HTTPRequest *request = new HTTPRequest(url);
+	HTTPRequest *request = new HTTPRequest(url, g_PluginQuotas.GetUsage(pContext));
 
 	HandleError err;
 	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
@@ -312,6 +362,52 @@ static cell_t PerformPutRequest(IPluginContext *pContext, const cell_t *params)
 	return 1;
 }
 
+static cell_t PerformPostAndForgetRequest(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	json_t *data = GetJSONFromHandle(pContext, params[2]);
+	if (data == nullptr)
+	{
+		return 0;
+	}
+
+	request->Perform("POST", data, nullptr, 0);
+
+	handlesys->FreeHandle(params[1], &sec);
+
+	return 1;
+}
+
+static cell_t PerformPutAndForgetRequest(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	json_t *data = GetJSONFromHandle(pContext, params[2]);
+	if (data == nullptr)
+	{
+		return 0;
+	}
+
+	request->Perform("PUT", data, nullptr, 0);
+
+	handlesys->FreeHandle(params[1], &sec);
+
+	return 1;
+}
+
 static cell_t PerformPatchRequest(IPluginContext *pContext, const cell_t *params)
 {
 	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
@@ -389,7 +485,7 @@ static cell_t PerformDownloadFile(IPluginContext *pContext, const cell_t *params
 	IPluginFunction *progresscallback = pContext->GetFunctionById(params[4]);
 	cell_t value = params[5];
 
-	IChangeableForward *forward = forwards->CreateForwardEx(nullptr, ET_Ignore, 3, nullptr, Param_Cell, Param_Cell, Param_String);
+	IChangeableForward *forward = forwards->CreateForwardEx(nullptr, ET_Ignore, 5, nullptr, Param_Cell, Param_Cell, Param_String, Param_String, Param_Cell);
 	if (forward == nullptr || !forward->AddFunction(callback))
 	{
 		pContext->ReportError("Could not create forward.");
@@ -403,7 +499,25 @@ static cell_t PerformDownloadFile(IPluginContext *pContext, const cell_t *params
 		return 0;
 	}
 
-	request->DownloadFile(path, forward, progressforward ,value);
+	/* Plugins compiled against an older include don't pass a digest */
+	DigestType digestType = DigestType_None;
+	char *expectedDigest = (char *)"";
+	if (params[0] >= 7)
+	{
+		digestType = (DigestType)params[6];
+		pContext->LocalToString(params[7], &expectedDigest);
+	}
+
+	if (digestType < DigestType_None || digestType >= DigestType_Count)
+	{
+		forwards->ReleaseForward(forward);
+		forwards->ReleaseForward(progressforward);
+
+		pContext->ReportError("Invalid digest type %d", digestType);
+		return 0;
+	}
+
+	request->DownloadFile(path, forward, progressforward, value, digestType, expectedDigest);
 
 	handlesys->FreeHandle(params[1], &sec);
 
@@ -427,7 +541,7 @@ static cell_t PerformUploadFile(IPluginContext *pContext, const cell_t *params)
 	IPluginFunction *progresscallback = pContext->GetFunctionById(params[4]);
 	cell_t value = params[5];
 
-	IChangeableForward *forward = forwards->CreateForwardEx(nullptr, ET_Ignore, 3, nullptr, Param_Cell, Param_Cell, Param_String);
+	IChangeableForward *forward = forwards->CreateForwardEx(nullptr, ET_Ignore, 5, nullptr, Param_Cell, Param_Cell, Param_String, Param_String, Param_Cell);
 	if (forward == nullptr || !forward->AddFunction(callback))
 	{
 		pContext->ReportError("Could not create forward.");
@@ -441,7 +555,25 @@ static cell_t PerformUploadFile(IPluginContext *pContext, const cell_t *params)
 		return 0;
 	}
 
-	request->UploadFile(path, forward, progressforward ,value);
+	/* Plugins compiled against an older include don't pass a range */
+	int64_t offset = 0;
+	int64_t length = -1;
+	if (params[0] >= 7)
+	{
+		offset = params[6];
+		length = params[7];
+	}
+
+	if (offset < 0)
+	{
+		forwards->ReleaseForward(forward);
+		forwards->ReleaseForward(progressforward);
+
+		pContext->ReportError("Invalid upload offset %d", params[6]);
+		return 0;
+	}
+
+	request->UploadFile(path, forward, progressforward, value, offset, length);
 	
 	handlesys->FreeHandle(params[1], &sec);
 
@@ -475,6 +607,179 @@ static cell_t PerformPostForm(IPluginContext *pContext, const cell_t *params)
 	return 1;
 }
 
+static cell_t AppendRequestMultipartField(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	char *name, *value, *contentType;
+	pContext->LocalToString(params[2], &name);
+	pContext->LocalToString(params[3], &value);
+	pContext->LocalToString(params[4], &contentType);
+
+	if (name[0] == '\0')
+	{
+		pContext->ReportError("Field name cannot be empty.");
+		return 0;
+	}
+
+	request->AppendMultipartField(name, value, contentType);
+
+	return 1;
+}
+
+static cell_t AppendRequestMultipartFile(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	char *name, *path, *filename, *contentType;
+	pContext->LocalToString(params[2], &name);
+	pContext->LocalToString(params[3], &path);
+	pContext->LocalToString(params[4], &filename);
+	pContext->LocalToString(params[5], &contentType);
+
+	if (name[0] == '\0')
+	{
+		pContext->ReportError("Field name cannot be empty.");
+		return 0;
+	}
+
+	request->AppendMultipartFile(name, path, filename, contentType);
+
+	return 1;
+}
+
+static cell_t PerformPostMultipart(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	IPluginFunction *callback = pContext->GetFunctionById(params[2]);
+	cell_t value = params[3];
+
+	IChangeableForward *forward = forwards->CreateForwardEx(nullptr, ET_Ignore, 3, nullptr, Param_Cell, Param_Cell, Param_String);
+	if (forward == nullptr || !forward->AddFunction(callback))
+	{
+		pContext->ReportError("Could not create forward.");
+		return 0;
+	}
+
+	request->PostMultipart(forward, value);
+
+	handlesys->FreeHandle(params[1], &sec);
+
+	return 1;
+}
+
+static cell_t PerformPostStream(IPluginContext *pContext, const cell_t *params)
+{
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return BAD_HANDLE;
+	}
+
+	IPluginFunction *callback = pContext->GetFunctionById(params[2]);
+	cell_t value = params[3];
+
+	IChangeableForward *forward = forwards->CreateForwardEx(nullptr, ET_Ignore, 3, nullptr, Param_Cell, Param_Cell, Param_String);
+	if (forward == nullptr || !forward->AddFunction(callback))
+	{
+		pContext->ReportError("Could not create forward.");
+		return BAD_HANDLE;
+	}
+
+	std::shared_ptr<UploadStream> *stream = new std::shared_ptr<UploadStream>(request->PostStream(forward, value));
+
+	handlesys->FreeHandle(params[1], &sec);
+
+	HandleError err;
+	Handle_t hndlStream = handlesys->CreateHandleEx(htHTTPUploadStream, stream, &sec, nullptr, &err);
+	if (hndlStream == BAD_HANDLE)
+	{
+		/* End the body, so the request still completes */
+		(*stream)->Finish();
+		delete stream;
+
+		pContext->ReportError("Could not create HTTPUploadStream handle (error %d)", err);
+		return BAD_HANDLE;
+	}
+
+	return hndlStream;
+}
+
+static cell_t WriteUploadStream(IPluginContext *pContext, const cell_t *params)
+{
+	UploadStream *stream = GetStreamFromHandle(pContext, params[1]);
+	if (stream == nullptr)
+	{
+		return 0;
+	}
+
+	char *data;
+	pContext->LocalToString(params[2], &data);
+
+	if (params[3] < 0)
+	{
+		pContext->ReportError("Invalid length %d", params[3]);
+		return 0;
+	}
+
+	return (cell_t)stream->Write(data, params[3]);
+}
+
+static cell_t WriteUploadStreamString(IPluginContext *pContext, const cell_t *params)
+{
+	UploadStream *stream = GetStreamFromHandle(pContext, params[1]);
+	if (stream == nullptr)
+	{
+		return 0;
+	}
+
+	char *data;
+	pContext->LocalToString(params[2], &data);
+
+	return (cell_t)stream->Write(data, strlen(data));
+}
+
+static cell_t FinishUploadStream(IPluginContext *pContext, const cell_t *params)
+{
+	UploadStream *stream = GetStreamFromHandle(pContext, params[1]);
+	if (stream == nullptr)
+	{
+		return 0;
+	}
+
+	stream->Finish();
+
+	return 1;
+}
+
+static cell_t GetUploadStreamQueuedBytes(IPluginContext *pContext, const cell_t *params)
+{
+	UploadStream *stream = GetStreamFromHandle(pContext, params[1]);
+	if (stream == nullptr)
+	{
+		return 0;
+	}
+
+	return (cell_t)stream->GetQueuedBytes();
+}
+
 static cell_t GetRequestConnectTimeout(IPluginContext *pContext, const cell_t *params)
 {
 	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
@@ -595,52 +900,172 @@ static cell_t SetRequestTimeout(IPluginContext *pContext, const cell_t *params)
 	return 1;
 }
 
-static cell_t GetResponseDataLength(IPluginContext *pContext, const cell_t *params)
+static cell_t GetRequestHTTPVersion(IPluginContext *pContext, const cell_t *params)
 {
-	HandleError err;
-	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
-
-	struct HTTPResponse *response;
-	Handle_t hndlResponse = static_cast<Handle_t>(params[1]);
-	if ((err = handlesys->ReadHandle(hndlResponse, htHTTPResponse, &sec, (void **)&response)) != HandleError_None)
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
 	{
-		pContext->ReportError("Invalid HTTP response handle %x (error %d)", hndlResponse, err);
 		return 0;
 	}
 
-	return response->size;
+	return request->GetHTTPVersion();
 }
 
-static cell_t GetResponseData(IPluginContext *pContext, const cell_t *params)
+static cell_t SetRequestHTTPVersion(IPluginContext *pContext, const cell_t *params)
 {
-	HandleError err;
-	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
-
-	struct HTTPResponse *response;
-	Handle_t hndlResponse = static_cast<Handle_t>(params[1]);
-	if ((err = handlesys->ReadHandle(hndlResponse, htHTTPResponse, &sec, (void **)&response)) != HandleError_None)
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
 	{
-		pContext->ReportError("Invalid HTTP response handle %x (error %d)", hndlResponse, err);
-		return BAD_HANDLE;
+		return 0;
 	}
 
-	/* Return the same handle every time we get the HTTP response data */
-	if (response->hndlData == BAD_HANDLE)
+	if (params[2] < CURL_HTTP_VERSION_NONE || params[2] > HTTP_VERSION_MAX)
 	{
-		json_error_t error;
-		response->data = json_loads(response->body, 0, &error);
-		if (response->data == nullptr)
-		{
-			pContext->ReportError("Invalid JSON in line %d, column %d: %s", error.line, error.column, error.text);
-			return BAD_HANDLE;
-		}
+		pContext->ReportError("Invalid HTTP version %d.", params[2]);
+		return 0;
+	}
 
-		response->hndlData = handlesys->CreateHandleEx(htJSON, response->data, &sec, nullptr, &err);
-		if (response->hndlData == BAD_HANDLE)
-		{
-			json_decref(response->data);
+	request->SetHTTPVersion(params[2]);
 
-			pContext->ReportError("Could not create data handle (error %d)", err);
+	return 1;
+}
+
+static cell_t GetRequestPriority(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	return request->GetPriority();
+}
+
+static cell_t SetRequestPriority(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	if (params[2] < 0 || params[2] >= RequestPriority_Count)
+	{
+		pContext->ReportError("Invalid request priority %d.", params[2]);
+		return 0;
+	}
+
+	request->SetPriority((RequestPriority)params[2]);
+
+	return 1;
+}
+
+static cell_t SetRequestRetryPolicy(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	if (params[2] < 1)
+	{
+		pContext->ReportError("Max attempts must be at least 1.");
+		return 0;
+	}
+
+	if (params[3] < 1 || params[4] < params[3])
+	{
+		pContext->ReportError("Invalid retry delays %d and %d.", params[3], params[4]);
+		return 0;
+	}
+
+	request->SetRetryPolicy(params[2], params[3], params[4], params[5]);
+
+	return 1;
+}
+
+static cell_t AddRequestRetryStatus(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	request->AddRetryStatus(params[2]);
+
+	return 1;
+}
+
+static cell_t SetRequestHedging(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPRequest *request = GetRequestFromHandle(pContext, params[1]);
+	if (request == nullptr)
+	{
+		return 0;
+	}
+
+	if (params[2] < 0)
+	{
+		pContext->ReportError("Invalid hedge delay %d.", params[2]);
+		return 0;
+	}
+
+	char *alternateUrl;
+	pContext->LocalToString(params[3], &alternateUrl);
+
+	request->SetHedging(params[2], alternateUrl);
+
+	return 1;
+}
+
+static cell_t GetResponseDataLength(IPluginContext *pContext, const cell_t *params)
+{
+	HandleError err;
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+
+	struct HTTPResponse *response;
+	Handle_t hndlResponse = static_cast<Handle_t>(params[1]);
+	if ((err = handlesys->ReadHandle(hndlResponse, htHTTPResponse, &sec, (void **)&response)) != HandleError_None)
+	{
+		pContext->ReportError("Invalid HTTP response handle %x (error %d)", hndlResponse, err);
+		return 0;
+	}
+
+	return response->size;
+}
+
+static cell_t GetResponseData(IPluginContext *pContext, const cell_t *params)
+{
+	HandleError err;
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+
+	struct HTTPResponse *response;
+	Handle_t hndlResponse = static_cast<Handle_t>(params[1]);
+	if ((err = handlesys->ReadHandle(hndlResponse, htHTTPResponse, &sec, (void **)&response)) != HandleError_None)
+	{
+		pContext->ReportError("Invalid HTTP response handle %x (error %d)", hndlResponse, err);
+		return BAD_HANDLE;
+	}
+
+	/* Return the same handle every time we get the HTTP response data */
+	if (response->hndlData == BAD_HANDLE)
+	{
+		json_error_t error;
+		response->data = json_loads(response->body, 0, &error);
+		if (response->data == nullptr)
+		{
+			pContext->ReportError("Invalid JSON in line %d, column %d: %s", error.line, error.column, error.text);
+			return BAD_HANDLE;
+		}
+
+		response->hndlData = handlesys->CreateHandleEx(htJSON, response->data, &sec, nullptr, &err);
+		if (response->hndlData == BAD_HANDLE)
+		{
+			json_decref(response->data);
+
+			pContext->ReportError("Could not create data handle (error %d)", err);
 			return BAD_HANDLE;
 		}
 	}
@@ -715,6 +1140,500 @@ static cell_t GetResponseHeader(IPluginContext *pContext, const cell_t *params)
 	return 1;
 }
 
+static cell_t CreateEventSource(IPluginContext *pContext, const cell_t *params)
+{
+	char *url;
+	pContext->LocalToString(params[1], &url);
+
+	if (url[0] == '\0')
+	{
+		pContext->ReportError("URL cannot be empty.");
+		return BAD_HANDLE;
+	}
+
+	std::shared_ptr<EventSource> *source = new std::shared_ptr<EventSource>(std::make_shared<EventSource>(url, g_PluginQuotas.GetUsage(pContext)));
+
+	HandleError err;
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+	Handle_t hndlSource = handlesys->CreateHandleEx(htEventSource, source, &sec, nullptr, &err);
+	if (hndlSource == BAD_HANDLE)
+	{
+		delete source;
+
+		pContext->ReportError("Could not create EventSource handle (error %d)", err);
+		return BAD_HANDLE;
+	}
+
+	return hndlSource;
+}
+
+static cell_t SetEventSourceHeader(IPluginContext *pContext, const cell_t *params)
+{
+	EventSource *source = GetEventSourceFromHandle(pContext, params[1]);
+	if (source == nullptr)
+	{
+		return 0;
+	}
+
+	char *name;
+	pContext->LocalToString(params[2], &name);
+
+	char value[8192];
+	{
+		DetectExceptions eh(pContext);
+		smutils->FormatString(value, sizeof(value), pContext, params, 3);
+
+		if (eh.HasException())
+		{
+			return 0;
+		}
+	}
+
+	source->SetHeader(name, value);
+
+	return 1;
+}
+
+static cell_t ConnectEventSource(IPluginContext *pContext, const cell_t *params)
+{
+	EventSource *source = GetEventSourceFromHandle(pContext, params[1]);
+	if (source == nullptr)
+	{
+		return 0;
+	}
+
+	IPluginFunction *callback = pContext->GetFunctionById(params[2]);
+	IPluginFunction *errorCallback = pContext->GetFunctionById(params[3]);
+	cell_t value = params[4];
+
+	IChangeableForward *forward = forwards->CreateForwardEx(nullptr, ET_Ignore, 5, nullptr, Param_Cell, Param_String, Param_String, Param_String, Param_Cell);
+	if (forward == nullptr || !forward->AddFunction(callback))
+	{
+		pContext->ReportError("Could not create forward.");
+		return 0;
+	}
+
+	IChangeableForward *errorForward = nullptr;
+	if (errorCallback != nullptr)
+	{
+		errorForward = forwards->CreateForwardEx(nullptr, ET_Ignore, 4, nullptr, Param_Cell, Param_String, Param_Cell, Param_Cell);
+		if (errorForward == nullptr || !errorForward->AddFunction(errorCallback))
+		{
+			forwards->ReleaseForward(forward);
+
+			pContext->ReportError("Could not create error forward.");
+			return 0;
+		}
+	}
+
+	if (!source->Connect(forward, errorForward, value, params[1]))
+	{
+		forwards->ReleaseForward(forward);
+		if (errorForward != nullptr)
+		{
+			forwards->ReleaseForward(errorForward);
+		}
+
+		pContext->ReportError("EventSource is already connected.");
+		return 0;
+	}
+
+	return 1;
+}
+
+static cell_t GetEventSourceLastEventId(IPluginContext *pContext, const cell_t *params)
+{
+	EventSource *source = GetEventSourceFromHandle(pContext, params[1]);
+	if (source == nullptr)
+	{
+		return 0;
+	}
+
+	std::string id = source->GetLastEventId();
+	pContext->StringToLocalUTF8(params[2], params[3], id.c_str(), nullptr);
+
+	return !id.empty();
+}
+
+static cell_t GetEventSourceReconnectDelay(IPluginContext *pContext, const cell_t *params)
+{
+	EventSource *source = GetEventSourceFromHandle(pContext, params[1]);
+	if (source == nullptr)
+	{
+		return 0;
+	}
+
+	return source->reconnectDelay;
+}
+
+static cell_t SetEventSourceReconnectDelay(IPluginContext *pContext, const cell_t *params)
+{
+	EventSource *source = GetEventSourceFromHandle(pContext, params[1]);
+	if (source == nullptr)
+	{
+		return 0;
+	}
+
+	if (params[2] < 0)
+	{
+		pContext->ReportError("Invalid reconnect delay %d", params[2]);
+		return 0;
+	}
+
+	source->reconnectDelay = params[2];
+
+	return 1;
+}
+
+static cell_t CreateBatcher(IPluginContext *pContext, const cell_t *params)
+{
+	char *url;
+	pContext->LocalToString(params[1], &url);
+
+	if (url[0] == '\0')
+	{
+		pContext->ReportError("URL cannot be empty.");
+		return BAD_HANDLE;
+	}
+
+	HTTPBatchFormat format = (HTTPBatchFormat)params[2];
+	if (format != HTTPBatchFormat_JSONArray && format != HTTPBatchFormat_NDJSON)
+	{
+		pContext->ReportError("Invalid batch format %d", format);
+		return BAD_HANDLE;
+	}
+
+	HTTPBatcher *batcher = new HTTPBatcher(url, format);
+
+	HandleError err;
+	HandleSecurity sec(pContext->GetIdentity(), myself->GetIdentity());
+	Handle_t hndlBatcher = handlesys->CreateHandleEx(htHTTPBatcher, batcher, &sec, nullptr, &err);
+	if (hndlBatcher == BAD_HANDLE)
+	{
+		delete batcher;
+
+		pContext->ReportError("Could not create HTTPBatcher handle (error %d)", err);
+		return BAD_HANDLE;
+	}
+
+	batcher->Start();
+
+	return hndlBatcher;
+}
+
+static cell_t SetBatcherHeader(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	char *name;
+	pContext->LocalToString(params[2], &name);
+
+	if (name[0] == '\0')
+	{
+		pContext->ReportError("Header name cannot be empty.");
+		return 0;
+	}
+
+	char value[8192];
+	{
+		DetectExceptions eh(pContext);
+		smutils->FormatString(value, sizeof(value), pContext, params, 3);
+
+		if (eh.HasException())
+		{
+			return 0;
+		}
+	}
+
+	batcher->SetHeader(name, value);
+
+	return 1;
+}
+
+static cell_t PushBatcherEvent(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	json_t *event = GetJSONFromHandle(pContext, params[2]);
+	if (event == nullptr)
+	{
+		return 0;
+	}
+
+	return batcher->Push(event);
+}
+
+static cell_t FlushBatcher(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	batcher->Flush();
+
+	return 1;
+}
+
+static cell_t GetBatcherMaxBatchSize(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	return batcher->maxBatchSize.load();
+}
+
+static cell_t SetBatcherMaxBatchSize(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	if (params[2] <= 0)
+	{
+		pContext->ReportError("Max batch size must be positive.");
+		return 0;
+	}
+
+	batcher->maxBatchSize.store(params[2]);
+
+	return 1;
+}
+
+static cell_t GetBatcherMaxBatchCount(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	return batcher->maxBatchCount.load();
+}
+
+static cell_t SetBatcherMaxBatchCount(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	if (params[2] <= 0)
+	{
+		pContext->ReportError("Max batch count must be positive.");
+		return 0;
+	}
+
+	batcher->maxBatchCount.store(params[2]);
+
+	return 1;
+}
+
+static cell_t GetBatcherFlushInterval(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	return batcher->flushInterval.load();
+}
+
+static cell_t SetBatcherFlushInterval(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	if (params[2] <= 0)
+	{
+		pContext->ReportError("Flush interval must be positive.");
+		return 0;
+	}
+
+	batcher->flushInterval.store(params[2]);
+
+	return 1;
+}
+
+static cell_t GetBatcherMaxSpillSize(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	return batcher->maxSpillSize.load();
+}
+
+static cell_t SetBatcherMaxSpillSize(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	if (params[2] <= 0)
+	{
+		pContext->ReportError("Max spill size must be positive.");
+		return 0;
+	}
+
+	batcher->maxSpillSize.store(params[2]);
+
+	return 1;
+}
+
+static cell_t GetBatcherCompress(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	return batcher->compress.load();
+}
+
+static cell_t SetBatcherCompress(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	batcher->compress.store(params[2] != 0);
+
+	return 1;
+}
+
+static cell_t GetBatcherPending(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	return batcher->pending.load();
+}
+
+static cell_t GetBatcherDropped(IPluginContext *pContext, const cell_t *params)
+{
+	HTTPBatcher *batcher = GetBatcherFromHandle(pContext, params[1]);
+	if (batcher == nullptr)
+	{
+		return 0;
+	}
+
+	return batcher->dropped.load();
+}
+
+static cell_t SetHTTPOption(IPluginContext *pContext, const cell_t *params)
+{
+	if (params[1] < 0 || params[1] >= HTTPOption_Count)
+	{
+		pContext->ReportError("Invalid HTTP option %d.", params[1]);
+		return 0;
+	}
+
+	HTTPOption option = (HTTPOption)params[1];
+	long value = params[2];
+
+	if (option == HTTPOption_HTTPVersion && (value < CURL_HTTP_VERSION_NONE || value > HTTP_VERSION_MAX))
+	{
+		pContext->ReportError("Invalid HTTP version %d.", params[2]);
+		return 0;
+	}
+	if (value < 0)
+	{
+		pContext->ReportError("Invalid value %d for HTTP option %d.", params[2], params[1]);
+		return 0;
+	}
+
+	g_Config.SetOption(option, value);
+
+	/* The multi handle must only be touched from the event loop thread */
+	if (RipExtConfig::IsMultiOption(option))
+	{
+		g_RipExt.RunOnLoop([]() {
+			g_Config.ApplyMultiOptions(g_Curl);
+		});
+	}
+
+	return 1;
+}
+
+static cell_t GetHTTPOption(IPluginContext *pContext, const cell_t *params)
+{
+	if (params[1] < 0 || params[1] >= HTTPOption_Count)
+	{
+		pContext->ReportError("Invalid HTTP option %d.", params[1]);
+		return 0;
+	}
+
+	return g_Config.GetOption((HTTPOption)params[1]);
+}
+
+enum HTTPStat
+{
+	HTTPStat_Queued = 0,
+	HTTPStat_Completed,
+	HTTPStat_Failed,
+	HTTPStat_BytesSent,
+	HTTPStat_BytesReceived,
+	HTTPStat_Retries,
+	HTTPStat_BusyTime,
+	HTTPStat_Latency,
+};
+
+static cell_t GetHTTPStat(IPluginContext *pContext, const cell_t *params)
+{
+	switch (params[1])
+	{
+		case HTTPStat_Queued:
+			return (cell_t)g_Stats.http.queued.load();
+		case HTTPStat_Completed:
+			return (cell_t)g_Stats.http.completed.load();
+		case HTTPStat_Failed:
+			return (cell_t)g_Stats.http.failed.load();
+		case HTTPStat_BytesSent:
+			return (cell_t)g_Stats.http.bytesSent.load();
+		case HTTPStat_BytesReceived:
+			return (cell_t)g_Stats.http.bytesReceived.load();
+		case HTTPStat_Retries:
+			return (cell_t)g_Stats.http.retries.load();
+		case HTTPStat_BusyTime:
+			return (cell_t)(g_Stats.http.busyTime.load() / 1000);
+		case HTTPStat_Latency:
+			return (cell_t)(g_Stats.http.latencyTotal.load() / 1000);
+	}
+
+	pContext->ReportError("Invalid HTTP stat %d.", params[1]);
+	return 0;
+}
+
 const sp_nativeinfo_t http_natives[] =
 	{
 		{"HTTPRequest.HTTPRequest", 				CreateRequest},
@@ -726,11 +1645,20 @@ const sp_nativeinfo_t http_natives[] =
 		{"HTTPRequest.Get", 						PerformGetRequest},
 		{"HTTPRequest.Post", 						PerformPostRequest},
 		{"HTTPRequest.Put", 						PerformPutRequest},
+		{"HTTPRequest.PostAndForget", 				PerformPostAndForgetRequest},
+		{"HTTPRequest.PutAndForget", 				PerformPutAndForgetRequest},
 		{"HTTPRequest.Patch", 						PerformPatchRequest},
 		{"HTTPRequest.Delete", 						PerformDeleteRequest},
 		{"HTTPRequest.DownloadFile", 				PerformDownloadFile},
 		{"HTTPRequest.UploadFile", 					PerformUploadFile},
 		{"HTTPRequest.PostForm", 					PerformPostForm},
+		{"HTTPRequest.AppendMultipartField", 		AppendRequestMultipartField},
+		{"HTTPRequest.AppendMultipartFile", 		AppendRequestMultipartFile},
+		{"HTTPRequest.PostMultipart", 				PerformPostMultipart},
+		{"HTTPRequest.PostStream", 					PerformPostStream},
+		{"HTTPRequest.SetRetryPolicy", 				SetRequestRetryPolicy},
+		{"HTTPRequest.AddRetryStatus", 				AddRequestRetryStatus},
+		{"HTTPRequest.SetHedging", 					SetRequestHedging},
 		{"HTTPRequest.ConnectTimeout.get", 			GetRequestConnectTimeout},
 		{"HTTPRequest.ConnectTimeout.set", 			SetRequestConnectTimeout},
 		{"HTTPRequest.MaxRedirects.get", 			GetRequestMaxRedirects},
@@ -741,11 +1669,45 @@ const sp_nativeinfo_t http_natives[] =
 		{"HTTPRequest.MaxSendSpeed.set", 			SetRequestMaxSendSpeed},
 		{"HTTPRequest.Timeout.get", 				GetRequestTimeout},
 		{"HTTPRequest.Timeout.set", 				SetRequestTimeout},
+		{"HTTPRequest.HTTPVersion.get", 			GetRequestHTTPVersion},
+		{"HTTPRequest.HTTPVersion.set", 			SetRequestHTTPVersion},
+		{"HTTPRequest.Priority.get", 				GetRequestPriority},
+		{"HTTPRequest.Priority.set", 				SetRequestPriority},
 		{"HTTPResponse.ResponseDataLength.get", 	GetResponseDataLength},
 		{"HTTPResponse.Data.get", 					GetResponseData},
 		{"HTTPResponse.GetResponseStr", 			GetResponseStr},
 		{"HTTPResponse.Status.get", 				GetResponseStatus},
 		{"HTTPResponse.GetHeader", 					GetResponseHeader},
+		{"HTTPUploadStream.Write", 					WriteUploadStream},
+		{"HTTPUploadStream.WriteString", 			WriteUploadStreamString},
+		{"HTTPUploadStream.Finish", 				FinishUploadStream},
+		{"HTTPUploadStream.QueuedBytes.get", 		GetUploadStreamQueuedBytes},
+		{"EventSource.EventSource", 				CreateEventSource},
+		{"EventSource.SetHeader", 					SetEventSourceHeader},
+		{"EventSource.Connect", 					ConnectEventSource},
+		{"EventSource.GetLastEventId", 				GetEventSourceLastEventId},
+		{"EventSource.ReconnectDelay.get", 			GetEventSourceReconnectDelay},
+		{"EventSource.ReconnectDelay.set", 			SetEventSourceReconnectDelay},
+		{"HTTPBatcher.HTTPBatcher", 				CreateBatcher},
+		{"HTTPBatcher.SetHeader", 					SetBatcherHeader},
+		{"HTTPBatcher.Push", 						PushBatcherEvent},
+		{"HTTPBatcher.Flush", 						FlushBatcher},
+		{"HTTPBatcher.MaxBatchSize.get", 			GetBatcherMaxBatchSize},
+		{"HTTPBatcher.MaxBatchSize.set", 			SetBatcherMaxBatchSize},
+		{"HTTPBatcher.MaxBatchCount.get", 			GetBatcherMaxBatchCount},
+		{"HTTPBatcher.MaxBatchCount.set", 			SetBatcherMaxBatchCount},
+		{"HTTPBatcher.FlushInterval.get", 			GetBatcherFlushInterval},
+		{"HTTPBatcher.FlushInterval.set", 			SetBatcherFlushInterval},
+		{"HTTPBatcher.MaxSpillSize.get", 			GetBatcherMaxSpillSize},
+		{"HTTPBatcher.MaxSpillSize.set", 			SetBatcherMaxSpillSize},
+		{"HTTPBatcher.Compress.get", 				GetBatcherCompress},
+		{"HTTPBatcher.Compress.set", 				SetBatcherCompress},
+		{"HTTPBatcher.Pending.get", 				GetBatcherPending},
+		{"HTTPBatcher.Dropped.get", 				GetBatcherDropped},
+
+		{"HTTPSetOption", 							SetHTTPOption},
+		{"HTTPGetOption", 							GetHTTPOption},
+		{"HTTPGetStat", 							GetHTTPStat},
 
 		{nullptr, 									nullptr}
 };
\ No newline at end of file
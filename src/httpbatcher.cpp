@@ -0,0 +1,437 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpbatcher.h"
+#include "config.h"
+#include "stats.h"
+#include <zlib.h>
+
+static size_t DiscardResponseBody(void *body, size_t size, size_t nmemb, void *userdata)
+{
+	return size * nmemb;
+}
+
+HTTPBatcher::HTTPBatcher(const std::string &url, HTTPBatchFormat format)
+	: url(url), format(format)
+{
+	SetHeader("Accept", "application/json");
+	SetHeader("Content-Type", format == HTTPBatchFormat_NDJSON ? "application/x-ndjson" : "application/json");
+}
+
+HTTPBatcher::~HTTPBatcher()
+{
+}
+
+void HTTPBatcher::Start()
+{
+	g_RipExt.RunOnLoop([this]() {
+		uv_async_init(g_Loop, &async, &OnAsync);
+		async.data = this;
+
+		appliedInterval = flushInterval.load();
+		uv_timer_init(g_Loop, &timer);
+		timer.data = this;
+		uv_timer_start(&timer, &OnTimer, appliedInterval, appliedInterval);
+
+		mutex.lock();
+		started = true;
+		mutex.unlock();
+
+		DrainInbox();
+		SendNext();
+	});
+}
+
+bool HTTPBatcher::Push(json_t *event)
+{
+	char *dump = json_dumps(event, JSON_COMPACT);
+	if (dump == nullptr)
+	{
+		return false;
+	}
+
+	bool wakeup;
+
+	mutex.lock();
+	inbox.emplace_back(dump);
+	wakeup = started;
+	mutex.unlock();
+
+	free(dump);
+
+	pending++;
+	g_Stats.batcher.events++;
+
+	/* Before Start() has run on the event loop the inbox is drained there instead */
+	if (wakeup)
+	{
+		uv_async_send(&async);
+	}
+
+	return true;
+}
+
+void HTTPBatcher::Flush()
+{
+	g_RipExt.RunOnLoop([this]() {
+		DrainInbox();
+		SealBatch();
+		SendNext();
+	});
+}
+
+void HTTPBatcher::Close()
+{
+	g_RipExt.RunOnLoop([this]() {
+		closing = true;
+
+		DrainInbox();
+		SealBatch();
+		SendNext();
+
+		if (!inFlight)
+		{
+			Destroy();
+		}
+	});
+}
+
+void HTTPBatcher::SetHeader(const char *name, const char *value)
+{
+	std::string vstr(value);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	headers.replace(name, std::move(vstr));
+}
+
+void HTTPBatcher::DrainInbox()
+{
+	std::vector<std::string> events;
+
+	mutex.lock();
+	events.swap(inbox);
+	mutex.unlock();
+
+	for (const std::string &event : events)
+	{
+		if (format == HTTPBatchFormat_JSONArray)
+		{
+			current.body.append(current.count == 0 ? "[" : ",");
+			current.body.append(event);
+		}
+		else
+		{
+			current.body.append(event);
+			current.body.append("\n");
+		}
+		current.count++;
+
+		if (current.body.size() >= (size_t)maxBatchSize.load() || current.count >= maxBatchCount.load())
+		{
+			SealBatch();
+		}
+	}
+}
+
+void HTTPBatcher::SealBatch()
+{
+	if (current.count == 0)
+	{
+		return;
+	}
+
+	if (format == HTTPBatchFormat_JSONArray)
+	{
+		current.body.append("]");
+	}
+
+	if (compress.load())
+	{
+		current.compressed = Compress(current.body);
+	}
+
+	spillSize += current.body.size();
+	spill.push_back(std::move(current));
+	current = HTTPBatch();
+
+	TrimSpillQueue();
+}
+
+void HTTPBatcher::SendNext()
+{
+	if (inFlight || spill.empty())
+	{
+		return;
+	}
+
+	HTTPBatch batch = std::move(spill.front());
+	spill.pop_front();
+	spillSize -= batch.body.size();
+
+	struct curl_slist *headers = BuildHeaders(batch.compressed);
+
+	inFlight = true;
+	g_RipExt.AddRequestToQueue(new HTTPBatchContext(this, url, std::move(batch), headers));
+}
+
+void HTTPBatcher::TrimSpillQueue()
+{
+	/* Drop the oldest batches first, but always keep the newest one */
+	while (spillSize > (size_t)maxSpillSize.load() && spill.size() > 1)
+	{
+		spillSize -= spill.front().body.size();
+		DropBatch(spill.front());
+		spill.pop_front();
+	}
+}
+
+void HTTPBatcher::DropBatch(const HTTPBatch &batch)
+{
+	pending -= batch.count;
+	dropped += batch.count;
+	g_Stats.batcher.eventsDropped += batch.count;
+}
+
+void HTTPBatcher::OnBatchCompleted(HTTPBatchContext *context, CURLcode result, long status)
+{
+	inFlight = false;
+	backoff = false;
+
+	bool success = (result == CURLE_OK && status >= 200 && status < 300);
+	bool retryable = (result != CURLE_OK || status >= 500 || status == 408 || status == 429);
+
+	if (success)
+	{
+		pending -= context->batch.count;
+		g_Stats.batcher.batchesSent++;
+	}
+	else if (retryable && !closing)
+	{
+		/* Keep the batch at the head of the spill queue, it is retried on the next flush */
+		spillSize += context->batch.body.size();
+		spill.push_front(std::move(context->batch));
+		TrimSpillQueue();
+		backoff = true;
+
+		g_Stats.batcher.batchesFailed++;
+		return;
+	}
+	else
+	{
+		g_RipExt.LogError("Dropping batch of %d events for %s (status %ld, curl error %d)", context->batch.count, url.c_str(), status, result);
+		DropBatch(context->batch);
+
+		g_Stats.batcher.batchesFailed++;
+	}
+
+	if (closing && !success)
+	{
+		/* The endpoint is down and nobody owns us any more, give up on the rest */
+		for (const HTTPBatch &batch : spill)
+		{
+			DropBatch(batch);
+		}
+		spill.clear();
+		spillSize = 0;
+	}
+
+	SendNext();
+
+	if (closing && !inFlight)
+	{
+		Destroy();
+	}
+}
+
+void HTTPBatcher::Destroy()
+{
+	uv_timer_stop(&timer);
+	uv_close((uv_handle_t *)&timer, &OnClosed);
+	uv_close((uv_handle_t *)&async, &OnClosed);
+}
+
+bool HTTPBatcher::Compress(std::string &body)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+
+	/* 15 window bits + 16 selects the gzip wrapper */
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		return false;
+	}
+
+	std::string compressed;
+	compressed.resize(deflateBound(&stream, body.size()));
+
+	stream.next_in = (Bytef *)body.data();
+	stream.avail_in = body.size();
+	stream.next_out = (Bytef *)&compressed[0];
+	stream.avail_out = compressed.size();
+
+	int res = deflate(&stream, Z_FINISH);
+	deflateEnd(&stream);
+
+	if (res != Z_STREAM_END)
+	{
+		return false;
+	}
+
+	compressed.resize(stream.total_out);
+	body.swap(compressed);
+
+	return true;
+}
+
+struct curl_slist *HTTPBatcher::BuildHeaders(bool compressed)
+{
+	struct curl_slist *headers = nullptr;
+	char header[8192];
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (HTTPHeaderMap::iterator iter = this->headers.iter(); !iter.empty(); iter.next())
+	{
+		snprintf(header, sizeof(header), "%s: %s", iter->key.c_str(), iter->value.c_str());
+		headers = curl_slist_append(headers, header);
+	}
+
+	if (compressed)
+	{
+		headers = curl_slist_append(headers, "Content-Encoding: gzip");
+	}
+
+	return headers;
+}
+
+void HTTPBatcher::OnAsync(uv_async_t *handle)
+{
+	HTTPBatcher *batcher = (HTTPBatcher *)handle->data;
+
+	batcher->DrainInbox();
+
+	/* New events must not resend a failed batch, that waits for the flush timer */
+	if (!batcher->backoff)
+	{
+		batcher->SendNext();
+	}
+}
+
+void HTTPBatcher::OnTimer(uv_timer_t *handle)
+{
+	HTTPBatcher *batcher = (HTTPBatcher *)handle->data;
+
+	int interval = batcher->flushInterval.load();
+	if (interval != batcher->appliedInterval && interval > 0)
+	{
+		batcher->appliedInterval = interval;
+		uv_timer_set_repeat(handle, interval);
+	}
+
+	batcher->DrainInbox();
+	batcher->SealBatch();
+	batcher->SendNext();
+}
+
+void HTTPBatcher::OnClosed(uv_handle_t *handle)
+{
+	HTTPBatcher *batcher = (HTTPBatcher *)handle->data;
+
+	if (++batcher->closedHandles == 2)
+	{
+		delete batcher;
+	}
+}
+
+HTTPBatchContext::HTTPBatchContext(HTTPBatcher *batcher, const std::string &url, HTTPBatch &&batch, struct curl_slist *headers)
+	: batch(std::move(batch)), batcher(batcher), url(url), headers(headers)
+{
+	httpVersion = g_Config.GetHTTPVersion(CURL_HTTP_VERSION_NONE, std::string());
+}
+
+HTTPBatchContext::~HTTPBatchContext()
+{
+	/* InitCurl failed, make sure the batcher does not wait for us forever */
+	if (!completed)
+	{
+		batcher->OnBatchCompleted(this, CURLE_FAILED_INIT, 0);
+	}
+
+	curl_easy_cleanup(curl);
+	curl_slist_free_all(headers);
+}
+
+bool HTTPBatchContext::InitCurl()
+{
+	curl = curl_easy_init();
+	if (curl == nullptr)
+	{
+		smutils->LogError(myself, "Could not initialize cURL session.");
+		return false;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+	curl_easy_setopt(curl, CURLOPT_CAINFO, g_RipExt.caBundlePath);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+	curl_easy_setopt(curl, CURLOPT_POST, 1L);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, batch.body.data());
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)batch.body.size());
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, this);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, SM_RIPEXT_USER_AGENT);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &DiscardResponseBody);
+
+	if (httpVersion != CURL_HTTP_VERSION_NONE)
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, httpVersion);
+	}
+
+#ifdef DEBUG
+	curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+#endif
+
+	return true;
+}
+
+void HTTPBatchContext::OnCompleted()
+{
+	/* Batches never reach the game thread */
+}
+
+bool HTTPBatchContext::IsFireAndForget()
+{
+	return true;
+}
+
+void HTTPBatchContext::OnLoopCompleted(CURLcode result)
+{
+	long status = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+	completed = true;
+	batcher->OnBatchCompleted(this, result, status);
+}
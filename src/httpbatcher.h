@@ -0,0 +1,139 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_HTTPBATCHER_H_
+#define SM_RIPEXT_HTTPBATCHER_H_
+
+#include "extension.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+enum HTTPBatchFormat
+{
+	HTTPBatchFormat_JSONArray = 0,
+	HTTPBatchFormat_NDJSON,
+};
+
+struct HTTPBatch
+{
+	std::string body;
+	int count = 0;
+	bool compressed = false;
+};
+
+class HTTPBatchContext;
+
+/**
+ * Accumulates small JSON events into bulk requests against a single endpoint.
+ *
+ * Events are serialized on the game thread and handed over to the event loop,
+ * which owns everything else: the open batch, the spill queue of sealed batches
+ * waiting to be sent, and the flush timer. Only one batch is in flight at a time,
+ * so a failing endpoint is retried once per flush interval instead of hammered.
+ */
+class HTTPBatcher
+{
+public:
+	HTTPBatcher(const std::string &url, HTTPBatchFormat format);
+	~HTTPBatcher();
+
+public: // Game thread
+	void Start();
+	bool Push(json_t *event);
+	void Flush();
+	void Close();
+	void SetHeader(const char *name, const char *value);
+
+public: // Event loop thread
+	void OnBatchCompleted(HTTPBatchContext *context, CURLcode result, long status);
+
+private:
+	void DrainInbox();
+	void SealBatch();
+	void SendNext();
+	void TrimSpillQueue();
+	void DropBatch(const HTTPBatch &batch);
+	void Destroy();
+	bool Compress(std::string &body);
+	struct curl_slist *BuildHeaders(bool compressed);
+
+	static void OnAsync(uv_async_t *handle);
+	static void OnTimer(uv_timer_t *handle);
+	static void OnClosed(uv_handle_t *handle);
+
+public:
+	std::atomic<int> maxBatchSize{256 * 1024};
+	std::atomic<int> maxBatchCount{500};
+	std::atomic<int> flushInterval{1000};
+	std::atomic<int> maxSpillSize{4 * 1024 * 1024};
+	std::atomic<bool> compress{false};
+
+	std::atomic<int> pending{0};
+	std::atomic<int> dropped{0};
+
+private:
+	const std::string url;
+	const HTTPBatchFormat format;
+
+	/* Shared between the game thread and the event loop */
+	std::mutex mutex;
+	std::vector<std::string> inbox;
+	HTTPHeaderMap headers;
+	bool started = false;
+
+	/* Owned by the event loop */
+	uv_async_t async;
+	uv_timer_t timer;
+	int appliedInterval = 0;
+	int closedHandles = 0;
+	HTTPBatch current;
+	std::deque<HTTPBatch> spill;
+	size_t spillSize = 0;
+	bool inFlight = false;
+	bool backoff = false; /* The last attempt failed, only the flush timer sends until one succeeds */
+	bool closing = false;
+};
+
+class HTTPBatchContext : public IHTTPContext
+{
+public:
+	HTTPBatchContext(HTTPBatcher *batcher, const std::string &url, HTTPBatch &&batch, struct curl_slist *headers);
+	~HTTPBatchContext();
+
+public: // IHTTPContext
+	bool InitCurl();
+	void OnCompleted();
+	bool IsFireAndForget();
+	void OnLoopCompleted(CURLcode result);
+
+public:
+	HTTPBatch batch;
+
+private:
+	bool completed = false;
+	HTTPBatcher *batcher;
+	const std::string url;
+	struct curl_slist *headers;
+};
+
+#endif // SM_RIPEXT_HTTPBATCHER_H_
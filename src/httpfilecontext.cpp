@@ -20,6 +20,8 @@
  */
 
 #include "httpfilecontext.h"
+#include "dispatch.h"
+#include "config.h"
 #include <sys/stat.h>
 
 static size_t IgnoreResponseBody(void *body, size_t size, size_t nmemb, void *userdata)
@@ -27,6 +29,18 @@ static size_t IgnoreResponseBody(void *body, size_t size, size_t nmemb, void *us
 	return size * nmemb;
 }
 
+static size_t WriteToDisk(char *data, size_t size, size_t nmemb, void *userdata)
+{
+	HTTPFileContext *context = (HTTPFileContext *)userdata;
+	return context->Write(data, size * nmemb);
+}
+
+static size_t ReadFromDisk(char *buffer, size_t size, size_t nmemb, void *userdata)
+{
+	HTTPFileContext *context = (HTTPFileContext *)userdata;
+	return context->Read(buffer, size * nmemb);
+}
+
 static size_t progress_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
 {
 	HTTPFileContext *context = (HTTPFileContext *)clientp;
@@ -38,17 +52,26 @@ HTTPFileContext::HTTPFileContext(bool isUpload, const std::string &url, const st
 								 struct curl_slist *headers, IChangeableForward *forward, IChangeableForward *progressForward, cell_t value,
 								 long connectTimeout, long maxRedirects, long timeout, curl_off_t maxSendSpeed, curl_off_t maxRecvSpeed,
 								 bool useBasicAuth, const std::string &username, const std::string &password, const std::string &proxy)
-	: isUpload(isUpload), url(url), path(path), headers(headers), forward(forward), progressForward(progressForward), value(value),
+	: isUpload(isUpload), url(url), path(path), headers(headers), forward(forward), value(value),
 	  connectTimeout(connectTimeout), maxRedirects(maxRedirects), timeout(timeout), maxSendSpeed(maxSendSpeed),
 	  maxRecvSpeed(maxRecvSpeed), useBasicAuth(useBasicAuth), username(username), password(password), proxy(proxy)
 {
+	if (progressForward != nullptr)
+	{
+		progress = std::make_shared<TransferProgress>(progressForward, isUpload);
+	}
 }
 
 HTTPFileContext::~HTTPFileContext()
 {
 	forwards->ReleaseForward(forward);
-	forwards->ReleaseForward(progressForward);
 
+	if (file != nullptr)
+	{
+		fclose(file);
+	}
+
+	delete writer;
 	curl_easy_cleanup(curl);
 	curl_slist_free_all(headers);
 }
@@ -65,26 +88,56 @@ bool HTTPFileContext::InitCurl()
 	char realpath[PLATFORM_MAX_PATH];
 	smutils->BuildPath(Path_Game, realpath, sizeof(realpath), "%s", path.c_str());
 
-	file = fopen(realpath, isUpload ? "rb" : "wb");
-	if (file == nullptr)
-	{
-		smutils->LogError(myself, "Could not open file %s.", path.c_str());
-		return false;
-	}
-
 	if (isUpload)
 	{
-		curl_easy_setopt(curl, CURLOPT_READDATA, file);
-		curl_easy_setopt(curl, CURLOPT_READFUNCTION, fread);
+		file = fopen(realpath, "rb");
+		if (file == nullptr)
+		{
+			smutils->LogError(myself, "Could not open file %s.", path.c_str());
+			return false;
+		}
+
+		/* Range errors are reported to the plugin through the completion callback */
+		int64_t size = FileSize(file);
+		if (rangeOffset > size)
+		{
+			snprintf(error, sizeof(error), "Upload range of file %s starts past its end", path.c_str());
+			initResult = CURLE_READ_ERROR;
+		}
+		else
+		{
+			if (rangeLength < 0 || rangeOffset + rangeLength > size)
+			{
+				rangeLength = size - rangeOffset;
+			}
+
+			if (!SeekToRange())
+			{
+				snprintf(error, sizeof(error), "Could not seek in file %s", path.c_str());
+				initResult = CURLE_READ_ERROR;
+			}
+		}
+
+		curl_easy_setopt(curl, CURLOPT_READDATA, this);
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, &ReadFromDisk);
 		curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+		curl_easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, SM_RIPEXT_UPLOAD_BUFFER_SIZE);
 		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "POST");
 		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &IgnoreResponseBody);
-		curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)FileSize(file));
+		curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)rangeLength);
 	}
 	else
 	{
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fwrite);
+		/* Downloads are written to disk off the event loop, see FileWriter */
+		writer = new FileWriter(curl);
+		if (!writer->Open(realpath))
+		{
+			smutils->LogError(myself, "Could not open file %s: %s.", path.c_str(), writer->GetError());
+			return false;
+		}
+
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &WriteToDisk);
 	}
 
 	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
@@ -104,14 +157,8 @@ bool HTTPFileContext::InitCurl()
 	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, &progress_callback);
 	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
 
-	if (maxRecvSpeed > 0)
-	{
-		curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, maxRecvSpeed);
-	}
-	if (maxSendSpeed > 0)
-	{
-		curl_easy_setopt(curl, CURLOPT_MAX_SEND_SPEED_LARGE, maxSendSpeed);
-	}
+	SetSpeedLimits(maxRecvSpeed, maxSendSpeed);
+
 	if (useBasicAuth)
 	{
 		curl_easy_setopt(curl, CURLOPT_USERNAME, username.c_str());
@@ -122,9 +169,10 @@ bool HTTPFileContext::InitCurl()
 		curl_easy_setopt(curl, CURLOPT_PROXY, proxy.c_str());
 	}
 
-#ifdef WIN32
-	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-#endif
+	if (httpVersion != CURL_HTTP_VERSION_NONE)
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, httpVersion);
+	}
 
 #ifdef DEBUG
 	curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
@@ -135,7 +183,18 @@ bool HTTPFileContext::InitCurl()
 
 void HTTPFileContext::OnCompleted()
 {
-	fclose(file);
+	if (file != nullptr)
+	{
+		fclose(file);
+		file = nullptr;
+	}
+
+	/* Deliver the final progress before the completion, and nothing after it */
+	if (progress)
+	{
+		progress->Deliver();
+		progress->Finish();
+	}
 
 	/* Return early if the plugin was unloaded while the thread was running */
 	if (forward->GetFunctionCount() == 0)
@@ -149,31 +208,222 @@ void HTTPFileContext::OnCompleted()
 	forward->PushCell(status);
 	forward->PushCell(value);
 	forward->PushString(error);
+	forward->PushString(computedDigest.c_str());
+	forward->PushCell(digestMatched);
 	forward->Execute(nullptr);
 }
 
+void HTTPFileContext::ResetForRetry()
+{
+	if (isUpload)
+	{
+		if (!SeekToRange())
+		{
+			smutils->LogError(myself, "Could not seek in file %s.", path.c_str());
+		}
+		return;
+	}
+
+	/* Start the download over, the file is truncated to the new size when it finishes */
+	writer->Reset();
+	digest.Reset();
+	preallocated = false;
+}
+
+bool HTTPFileContext::DeferCompletion(CURLcode result)
+{
+	if (writer == nullptr)
+	{
+		return false;
+	}
+
+	writer->Finish([this, result]() {
+		CURLcode finalResult = result;
+		if (finalResult == CURLE_OK && writer->Failed())
+		{
+			snprintf(error, sizeof(error), "Could not write file %s: %s", path.c_str(), writer->GetError());
+			finalResult = CURLE_WRITE_ERROR;
+		}
+
+		FinishDigest(finalResult);
+	});
+
+	return true;
+}
+
+void HTTPFileContext::SetRange(int64_t offset, int64_t length)
+{
+	rangeOffset = offset;
+	rangeLength = length;
+}
+
+bool HTTPFileContext::SeekToRange()
+{
+	rangeRemaining = rangeLength;
+
+#ifdef WIN32
+	return _fseeki64(file, rangeOffset, SEEK_SET) == 0;
+#else
+	return fseeko(file, rangeOffset, SEEK_SET) == 0;
+#endif
+}
+
+size_t HTTPFileContext::Read(char *buffer, size_t size)
+{
+	/* Reads straight into the upload buffer of libcurl, and stops at the end of the range */
+	size_t length = (size_t)std::min((int64_t)size, rangeRemaining);
+	if (length == 0)
+	{
+		return 0;
+	}
+
+	size_t read = fread(buffer, 1, length, file);
+	if (read == 0 && ferror(file))
+	{
+		return CURL_READFUNC_ABORT;
+	}
+
+	rangeRemaining -= read;
+	return read;
+}
+
+void HTTPFileContext::SetDigest(DigestType type, const std::string &expected)
+{
+	digest = Digest(type);
+	expectedDigest = expected;
+}
+
+void HTTPFileContext::FinishDigest(CURLcode result)
+{
+	if (digest.GetType() == DigestType_None)
+	{
+		g_RipExt.CompleteRequest(this, result);
+		return;
+	}
+
+	computedDigest = digest.Final();
+
+	/* Only a complete download can be verified */
+	if (result != CURLE_OK || expectedDigest.empty() || Digest::Matches(computedDigest, expectedDigest))
+	{
+		g_RipExt.CompleteRequest(this, result);
+		return;
+	}
+
+	digestMatched = false;
+	snprintf(error, sizeof(error), "Digest mismatch, expected %s but got %s", expectedDigest.c_str(), computedDigest.c_str());
+
+	char realpath[PLATFORM_MAX_PATH];
+	smutils->BuildPath(Path_Game, realpath, sizeof(realpath), "%s", path.c_str());
+
+	discardRequest.data = this;
+	discardResult = result;
+	uv_fs_unlink(g_Loop, &discardRequest, realpath, &OnDiscarded);
+}
+
+void HTTPFileContext::OnDiscarded(uv_fs_t *req)
+{
+	HTTPFileContext *context = (HTTPFileContext *)req->data;
+	uv_fs_req_cleanup(req);
+
+	g_RipExt.CompleteRequest(context, context->discardResult);
+}
+
+size_t HTTPFileContext::Write(const char *data, size_t size)
+{
+	/* Reserve the space for the whole download once its size is known */
+	if (!preallocated)
+	{
+		preallocated = true;
+
+		curl_off_t length;
+		if (curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK && length > 0)
+		{
+			writer->Preallocate(length);
+		}
+	}
+
+	size_t written = writer->Write(data, size);
+	if (written == size)
+	{
+		digest.Update(data, size);
+	}
+
+	return written;
+}
+
 void HTTPFileContext::setProgressData(curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+	if (progress && (dltotal != 0 || ultotal != 0))
+	{
+		progress->Update(dltotal, dlnow, ultotal, ulnow);
+	}
+}
+
+TransferProgress::TransferProgress(IChangeableForward *forward, bool isUpload)
+	: forward(forward), isUpload(isUpload)
+{
+}
+
+TransferProgress::~TransferProgress()
+{
+	forwards->ReleaseForward(forward);
+}
+
+void TransferProgress::Update(curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
 {
 	this->dltotal = dltotal;
 	this->dlnow = dlnow;
 	this->ultotal = ultotal;
 	this->ulnow = ulnow;
-	if (dltotal != 0 || ultotal != 0)
+	this->dirty = true;
+
+	/* Rate limit the updates, the values in between are simply overwritten */
+	uint64_t now = uv_now(g_Loop);
+	if (now < nextUpdate)
 	{
-		g_RipExt.Defer([this](){
-			if (this->progressForward && this->progressForward->GetFunctionCount() != 0)
-			{
-				this->progressForward->PushCell(this->isUpload);
-				this->progressForward->PushCell((cell_t)this->dltotal);
-				this->progressForward->PushCell((cell_t)this->dlnow);
-				this->progressForward->PushCell((cell_t)this->ultotal);
-				this->progressForward->PushCell((cell_t)this->ulnow);
-				this->progressForward->Execute(nullptr);
-			}
+		return;
+	}
+
+	long rate = g_Config.GetOption(HTTPOption_ProgressRate);
+	nextUpdate = (rate > 0) ? now + 1000 / rate : 0;
+
+	/* Only one event per transfer is queued at a time, and it delivers the latest values */
+	if (!queued.exchange(true))
+	{
+		std::shared_ptr<TransferProgress> progress = shared_from_this();
+		g_Dispatcher.Defer([progress]() {
+			progress->queued = false;
+			progress->Deliver();
 		});
 	}
 }
 
+void TransferProgress::Deliver()
+{
+	if (finished || !dirty.exchange(false))
+	{
+		return;
+	}
+
+	if (forward->GetFunctionCount() == 0)
+	{
+		return;
+	}
+
+	forward->PushCell(isUpload);
+	forward->PushCell((cell_t)dltotal.load());
+	forward->PushCell((cell_t)dlnow.load());
+	forward->PushCell((cell_t)ultotal.load());
+	forward->PushCell((cell_t)ulnow.load());
+	forward->Execute(nullptr);
+}
+
+void TransferProgress::Finish()
+{
+	finished = true;
+}
+
 off_t FileSize(FILE *fd)
 {
 #ifdef WIN32
@@ -24,6 +24,41 @@
 
 #include <stdio.h>
 #include "extension.h"
+#include "filewriter.h"
+#include "digest.h"
+#include <atomic>
+
+/*
+ * Progress of a transfer, shared between the transfer and its queued progress
+ * event. Only the latest values are delivered, and at most one event is queued
+ * at a time, so the event can outlive the transfer safely.
+ */
+class TransferProgress : public std::enable_shared_from_this<TransferProgress>
+{
+public:
+	TransferProgress(IChangeableForward *forward, bool isUpload);
+	~TransferProgress();
+
+	/* Called on the event loop thread for every libcurl progress tick */
+	void Update(curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+
+	/* Called on the game thread */
+	void Deliver();
+	void Finish();
+
+private:
+	IChangeableForward *forward;
+	bool isUpload;
+	bool finished = false;
+
+	std::atomic<curl_off_t> dltotal{0};
+	std::atomic<curl_off_t> dlnow{0};
+	std::atomic<curl_off_t> ultotal{0};
+	std::atomic<curl_off_t> ulnow{0};
+	std::atomic<bool> dirty{false};
+	std::atomic<bool> queued{false};
+	uint64_t nextUpdate = 0;
+};
 
 class HTTPFileContext : public IHTTPContext
 {
@@ -37,23 +72,48 @@ public:
 public: // IHTTPContext
 	bool InitCurl();
 	void OnCompleted();
+	void ResetForRetry();
+	bool DeferCompletion(CURLcode result);
 	void setProgressData(curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
 
+	size_t Write(const char *data, size_t size);
+
+	/* Uploads only part of the file, a negative length reads up to the end of the file */
+	void SetRange(int64_t offset, int64_t length);
+
+	size_t Read(char *buffer, size_t size);
+
+	/* Hashes the download while it is written, and discards the file if it does not match the expected digest */
+	void SetDigest(DigestType type, const std::string &expected);
+
+private:
+	bool SeekToRange();
+	void FinishDigest(CURLcode result);
+	static void OnDiscarded(uv_fs_t *req);
+
 private:
 	FILE *file = nullptr;
-	curl_off_t dltotal;
-	curl_off_t dlnow;
-	curl_off_t ultotal;
-	curl_off_t ulnow;
+	FileWriter *writer = nullptr;
+	bool preallocated = false;
+
+	int64_t rangeOffset = 0;
+	int64_t rangeLength = -1;
+	int64_t rangeRemaining = 0;
+
+	Digest digest;
+	std::string expectedDigest;
+	std::string computedDigest;
+	bool digestMatched = true;
+	uv_fs_t discardRequest;
+	CURLcode discardResult;
+	std::shared_ptr<TransferProgress> progress;
 
 	bool isUpload;
 	const std::string url;
 	const std::string path;
 	struct curl_slist *headers;
 	IChangeableForward *forward;
-	IChangeableForward *progressForward;
 	cell_t value;
-	char error[CURL_ERROR_SIZE] = {'\0'};
 	long connectTimeout;
 	long maxRedirects;
 	long timeout;
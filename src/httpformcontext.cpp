@@ -115,14 +115,8 @@ bool HTTPFormContext::InitCurl()
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &WriteResponseBody);
 
-	if (maxRecvSpeed > 0)
-	{
-		curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, maxRecvSpeed);
-	}
-	if (maxSendSpeed > 0)
-	{
-		curl_easy_setopt(curl, CURLOPT_MAX_SEND_SPEED_LARGE, maxSendSpeed);
-	}
+	SetSpeedLimits(maxRecvSpeed, maxSendSpeed);
+
 	if (useBasicAuth)
 	{
 		curl_easy_setopt(curl, CURLOPT_USERNAME, username.c_str());
@@ -133,9 +127,10 @@ bool HTTPFormContext::InitCurl()
 		curl_easy_setopt(curl, CURLOPT_PROXY, proxy.c_str());
 	}
 
-#ifdef WIN32
-	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-#endif
+	if (httpVersion != CURL_HTTP_VERSION_NONE)
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, httpVersion);
+	}
 
 #ifdef DEBUG
 	curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
@@ -170,4 +165,12 @@ void HTTPFormContext::OnCompleted()
 
 	handlesys->FreeHandle(hndlResponse, &sec);
 	handlesys->FreeHandle(response.hndlData, &sec);
+}
+
+void HTTPFormContext::ResetForRetry()
+{
+	free(response.body);
+	response.body = nullptr;
+	response.size = 0;
+	response.headers.clear();
 }
\ No newline at end of file
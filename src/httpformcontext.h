@@ -36,6 +36,7 @@ public:
 public: // IHTTPContext
 	bool InitCurl();
 	void OnCompleted();
+	void ResetForRetry();
 
 private:
 	struct HTTPResponse response;
@@ -45,7 +46,6 @@ private:
 	struct curl_slist *headers;
 	IChangeableForward *forward;
 	cell_t value;
-	char error[CURL_ERROR_SIZE] = {'\0'};
 	long connectTimeout;
 	long maxRedirects;
 	long timeout;
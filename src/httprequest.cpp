@@ -23,9 +23,12 @@
 #include "httprequestcontext.h"
 #include "httpfilecontext.h"
 #include "httpformcontext.h"
+#include "httpuploadcontext.h"
+#include "config.h"
+#include "quota.h"
 
-HTTPRequest::HTTPRequest(const std::string &url)
-	: url(url)
+HTTPRequest::HTTPRequest(const std::string &url, std::shared_ptr<PluginUsage> owner)
+	: url(url), owner(owner)
 {
 	SetHeader("Accept", "application/json");
 	SetHeader("Content-Type", "application/json");
@@ -36,29 +39,45 @@ void HTTPRequest::Perform(const char *method, json_t *data, IChangeableForward *
 	HTTPRequestContext *context = new HTTPRequestContext(method, BuildURL(), data, BuildHeaders(), forward, value,
 														 connectTimeout, maxRedirects, timeout, maxSendSpeed, maxRecvSpeed, useBasicAuth, username, password, proxy);
 
-	g_RipExt.AddRequestToQueue(context);
+	/* Only idempotent requests are safe to send twice */
+	if (strcmp(method, "GET") == 0 && forward != nullptr)
+	{
+		context->hedgePolicy = hedgePolicy;
+
+		/* The alternate URL gets the same query parameters as the primary one */
+		if (!hedgePolicy.alternateUrl.empty())
+		{
+			context->hedgePolicy.alternateUrl.append(query);
+		}
+	}
+
+	Enqueue(context);
 }
 
-void HTTPRequest::DownloadFile(const char *path, IChangeableForward *forward, IChangeableForward *progressForward, cell_t value)
+void HTTPRequest::DownloadFile(const char *path, IChangeableForward *forward, IChangeableForward *progressForward, cell_t value,
+							   DigestType digestType, const std::string &expectedDigest)
 {
 	SetHeader("Accept", "*/*");
 	SetHeader("Content-Type", "application/octet-stream");
 
 	HTTPFileContext *context = new HTTPFileContext(false, BuildURL(), path, BuildHeaders(), forward, progressForward, value,
 												   connectTimeout, maxRedirects, timeout, maxSendSpeed, maxRecvSpeed, useBasicAuth, username, password, proxy);
+	context->SetDigest(digestType, expectedDigest);
 
-	g_RipExt.AddRequestToQueue(context);
+	Enqueue(context);
 }
 
-void HTTPRequest::UploadFile(const char *path, IChangeableForward *forward, IChangeableForward *progressForward, cell_t value)
+void HTTPRequest::UploadFile(const char *path, IChangeableForward *forward, IChangeableForward *progressForward, cell_t value,
+							 int64_t offset, int64_t length)
 {
 	SetHeader("Accept", "*/*");
 	SetHeader("Content-Type", "application/octet-stream");
 
 	HTTPFileContext *context = new HTTPFileContext(true, BuildURL(), path, BuildHeaders(), forward, progressForward, value,
 												   connectTimeout, maxRedirects, timeout, maxSendSpeed, maxRecvSpeed, useBasicAuth, username, password, proxy);
+	context->SetRange(offset, length);
 
-	g_RipExt.AddRequestToQueue(context);
+	Enqueue(context);
 }
 
 void HTTPRequest::PostForm(IChangeableForward *forward, cell_t value)
@@ -69,9 +88,79 @@ void HTTPRequest::PostForm(IChangeableForward *forward, cell_t value)
 	HTTPFormContext *context = new HTTPFormContext(BuildURL(), formData, BuildHeaders(), forward, value,
 												   connectTimeout, maxRedirects, timeout, maxSendSpeed, maxRecvSpeed, useBasicAuth, username, password, proxy);
 
+	Enqueue(context);
+}
+
+void HTTPRequest::PostMultipart(IChangeableForward *forward, cell_t value)
+{
+	/* libcurl sets the Content-Type with the boundary */
+	SetHeader("Accept", "application/json");
+	headers.remove("Content-Type");
+
+	HTTPUploadContext *context = new HTTPUploadContext(BuildURL(), multipartParts, nullptr, BuildHeaders(), forward, value,
+													   connectTimeout, maxRedirects, timeout, maxSendSpeed, maxRecvSpeed, useBasicAuth, username, password, proxy);
+
+	Enqueue(context);
+}
+
+std::shared_ptr<UploadStream> HTTPRequest::PostStream(IChangeableForward *forward, cell_t value)
+{
+	SetHeader("Accept", "application/json");
+
+	/* The size isn't known up front, so HTTP/1.1 sends the body in chunks */
+	SetHeader("Transfer-Encoding", "chunked");
+
+	std::shared_ptr<UploadStream> stream = std::make_shared<UploadStream>();
+
+	HTTPUploadContext *context = new HTTPUploadContext(BuildURL(), {}, stream, BuildHeaders(), forward, value,
+													   connectTimeout, maxRedirects, timeout, maxSendSpeed, maxRecvSpeed, useBasicAuth, username, password, proxy);
+
+	Enqueue(context);
+
+	return stream;
+}
+
+void HTTPRequest::Enqueue(IHTTPContext *context)
+{
+	context->retryPolicy = retryPolicy;
+	context->host = GetHost(url);
+	context->requestedVersion = httpVersion;
+	context->httpVersion = g_Config.GetHTTPVersion(httpVersion, context->host);
+	context->priority = priority;
+	context->owner = owner;
+
+	/* Requests over the quota still go through the queue, so the callback is called as usual */
+	if (owner && !g_PluginQuotas.OnQueued(owner.get()))
+	{
+		context->rejected = true;
+	}
+
 	g_RipExt.AddRequestToQueue(context);
 }
 
+const std::string HTTPRequest::GetHost(const std::string &url)
+{
+	std::string host;
+
+	CURLU *handle = curl_url();
+	if (handle == nullptr)
+	{
+		return host;
+	}
+
+	char *part;
+	if (curl_url_set(handle, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK
+		&& curl_url_get(handle, CURLUPART_HOST, &part, 0) == CURLUE_OK)
+	{
+		host = part;
+		curl_free(part);
+	}
+
+	curl_url_cleanup(handle);
+
+	return host;
+}
+
 const std::string HTTPRequest::BuildURL() const
 {
 	std::string url(this->url);
@@ -128,6 +217,32 @@ void HTTPRequest::AppendFormParam(const char *name, const char *value)
 	curl_easy_cleanup(curl);
 }
 
+void HTTPRequest::AppendMultipartField(const char *name, const char *value, const char *contentType)
+{
+	MultipartPart part;
+	part.name = name;
+	part.value = value;
+	part.contentType = contentType;
+	part.isFile = false;
+
+	multipartParts.push_back(std::move(part));
+}
+
+void HTTPRequest::AppendMultipartFile(const char *name, const char *path, const char *filename, const char *contentType)
+{
+	char realpath[PLATFORM_MAX_PATH];
+	smutils->BuildPath(Path_Game, realpath, sizeof(realpath), "%s", path);
+
+	MultipartPart part;
+	part.name = name;
+	part.path = realpath;
+	part.filename = filename;
+	part.contentType = contentType;
+	part.isFile = true;
+
+	multipartParts.push_back(std::move(part));
+}
+
 struct curl_slist *HTTPRequest::BuildHeaders()
 {
 	struct curl_slist *headers = nullptr;
@@ -223,4 +338,44 @@ int HTTPRequest::GetTimeout() const
 void HTTPRequest::SetTimeout(int timeout)
 {
 	this->timeout = timeout;
+}
+
+long HTTPRequest::GetHTTPVersion() const
+{
+	return httpVersion;
+}
+
+void HTTPRequest::SetHTTPVersion(long httpVersion)
+{
+	this->httpVersion = httpVersion;
+}
+
+RequestPriority HTTPRequest::GetPriority() const
+{
+	return priority;
+}
+
+void HTTPRequest::SetPriority(RequestPriority priority)
+{
+	this->priority = priority;
+}
+
+void HTTPRequest::SetRetryPolicy(int maxAttempts, int baseDelay, int maxDelay, int retryOn)
+{
+	this->retryPolicy.maxAttempts = maxAttempts;
+	this->retryPolicy.baseDelay = baseDelay;
+	this->retryPolicy.maxDelay = maxDelay;
+	this->retryPolicy.retryOn = retryOn;
+}
+
+void HTTPRequest::AddRetryStatus(long status)
+{
+	this->retryPolicy.statuses.push_back(status);
+}
+
+void HTTPRequest::SetHedging(int delay, const char *alternateUrl)
+{
+	this->hedgePolicy.enabled = true;
+	this->hedgePolicy.delay = delay;
+	this->hedgePolicy.alternateUrl = alternateUrl;
 }
\ No newline at end of file
@@ -23,22 +23,31 @@
 #define SM_RIPEXT_HTTPREQUEST_H_
 
 #include "extension.h"
+#include "digest.h"
+#include "httpuploadcontext.h"
 
 class HTTPRequest
 {
 public:
-	HTTPRequest(const std::string &url);
+	HTTPRequest(const std::string &url, std::shared_ptr<PluginUsage> owner);
 
 	void Perform(const char *method, json_t *data, IChangeableForward *forward, cell_t value);
-	void DownloadFile(const char *path, IChangeableForward *forward, IChangeableForward *progressForward, cell_t value);
-	void UploadFile(const char *path, IChangeableForward *forward, IChangeableForward *progressForward, cell_t value);
+	void DownloadFile(const char *path, IChangeableForward *forward, IChangeableForward *progressForward, cell_t value,
+					  DigestType digestType = DigestType_None, const std::string &expectedDigest = "");
+	void UploadFile(const char *path, IChangeableForward *forward, IChangeableForward *progressForward, cell_t value,
+					int64_t offset = 0, int64_t length = -1);
 	void PostForm(IChangeableForward *forward, cell_t value);
+	void PostMultipart(IChangeableForward *forward, cell_t value);
+	std::shared_ptr<UploadStream> PostStream(IChangeableForward *forward, cell_t value);
 
 	const std::string BuildURL() const;
 	void AppendQueryParam(const char *name, const char *value);
 
 	void AppendFormParam(const char *name, const char *value);
 
+	void AppendMultipartField(const char *name, const char *value, const char *contentType);
+	void AppendMultipartFile(const char *name, const char *path, const char *filename, const char *contentType);
+
 	struct curl_slist *BuildHeaders();
 	void SetHeader(const char *name, const char *value);
 
@@ -63,10 +72,29 @@ public:
 	int GetTimeout() const;
 	void SetTimeout(int timeout);
 
+	long GetHTTPVersion() const;
+	void SetHTTPVersion(long httpVersion);
+
+	RequestPriority GetPriority() const;
+	void SetPriority(RequestPriority priority);
+
+	void SetRetryPolicy(int maxAttempts, int baseDelay, int maxDelay, int retryOn);
+	void AddRetryStatus(long status);
+
+	void SetHedging(int delay, const char *alternateUrl);
+
+	/* Host part of the URL, or an empty string if it cannot be parsed */
+	static const std::string GetHost(const std::string &url);
+
+private:
+	void Enqueue(IHTTPContext *context);
+
 private:
 	const std::string url;
+	std::shared_ptr<PluginUsage> owner;
 	std::string query;
 	std::string formData;
+	std::vector<MultipartPart> multipartParts;
 	HTTPHeaderMap headers;
 	bool useBasicAuth = false;
 	std::string username;
@@ -77,6 +105,10 @@ private:
 	int maxRecvSpeed = 0;
 	int maxSendSpeed = 0;
 	int timeout = 30;
+	long httpVersion = CURL_HTTP_VERSION_NONE;
+	RequestPriority priority = RequestPriority_Normal;
+	RetryPolicy retryPolicy;
+	HedgePolicy hedgePolicy;
 };
 
 #endif // SM_RIPEXT_HTTPREQUEST_H_
\ No newline at end of file
@@ -20,6 +20,8 @@
  */
 
 #include "httprequestcontext.h"
+#include "httprequest.h"
+#include "config.h"
 
 static size_t ReadRequestBody(void *body, size_t size, size_t nmemb, void *userdata)
 {
@@ -52,6 +54,11 @@ static size_t WriteResponseBody(void *body, size_t size, size_t nmemb, void *use
 	return total;
 }
 
+static size_t DiscardResponseBody(void *body, size_t size, size_t nmemb, void *userdata)
+{
+	return size * nmemb;
+}
+
 static size_t ReceiveResponseHeader(char *buffer, size_t size, size_t nmemb, void *userdata)
 {
 	size_t total = size * nmemb;
@@ -96,7 +103,10 @@ HTTPRequestContext::HTTPRequestContext(const std::string &method, const std::str
 
 HTTPRequestContext::~HTTPRequestContext()
 {
-	forwards->ReleaseForward(forward);
+	if (forward != nullptr)
+	{
+		forwards->ReleaseForward(forward);
+	}
 
 	curl_easy_cleanup(curl);
 	curl_slist_free_all(headers);
@@ -139,8 +149,6 @@ bool HTTPRequestContext::InitCurl()
 	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connectTimeout);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response);
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &ReceiveResponseHeader);
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, maxRedirects);
 	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
@@ -151,17 +159,21 @@ bool HTTPRequestContext::InitCurl()
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
 	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
 	curl_easy_setopt(curl, CURLOPT_USERAGENT, SM_RIPEXT_USER_AGENT);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &WriteResponseBody);
 
-	if (maxRecvSpeed > 0)
+	if (IsFireAndForget())
 	{
-		curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, maxRecvSpeed);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &DiscardResponseBody);
 	}
-	if (maxSendSpeed > 0)
+	else
 	{
-		curl_easy_setopt(curl, CURLOPT_MAX_SEND_SPEED_LARGE, maxSendSpeed);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &ReceiveResponseHeader);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &WriteResponseBody);
 	}
+
+	SetSpeedLimits(maxRecvSpeed, maxSendSpeed);
+
 	if (useBasicAuth)
 	{
 		curl_easy_setopt(curl, CURLOPT_USERNAME, username.c_str());
@@ -172,9 +184,10 @@ bool HTTPRequestContext::InitCurl()
 		curl_easy_setopt(curl, CURLOPT_PROXY, proxy.c_str());
 	}
 
-#ifdef WIN32
-	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-#endif
+	if (httpVersion != CURL_HTTP_VERSION_NONE)
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, httpVersion);
+	}
 
 #ifdef DEBUG
 	curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
@@ -209,4 +222,62 @@ void HTTPRequestContext::OnCompleted()
 
 	handlesys->FreeHandle(hndlResponse, &sec);
 	handlesys->FreeHandle(response.hndlData, &sec);
+}
+
+bool HTTPRequestContext::IsFireAndForget()
+{
+	/* A hedged transfer has no callback until it wins the race */
+	return forward == nullptr && !hedgeLeg;
+}
+
+void HTTPRequestContext::ResetForRetry()
+{
+	pos = 0;
+
+	free(response.body);
+	response.body = nullptr;
+	response.size = 0;
+	response.headers.clear();
+}
+
+IHTTPContext *HTTPRequestContext::CloneForHedge(const std::string &url)
+{
+	struct curl_slist *headers = nullptr;
+	for (struct curl_slist *header = this->headers; header != nullptr; header = header->next)
+	{
+		headers = curl_slist_append(headers, header->data);
+	}
+
+	HTTPRequestContext *context = new HTTPRequestContext(method, url.empty() ? this->url : url, nullptr, headers, nullptr, value,
+														 connectTimeout, maxRedirects, timeout, maxSendSpeed, maxRecvSpeed, useBasicAuth, username, password, proxy);
+
+	context->hedgeLeg = true;
+	context->retryPolicy = retryPolicy;
+	context->requestedVersion = requestedVersion;
+
+	/* The alternate URL may point at another host, with its own circuit breaker and HTTP version */
+	if (url.empty())
+	{
+		context->host = host;
+		context->httpVersion = httpVersion;
+	}
+	else
+	{
+		context->host = HTTPRequest::GetHost(url);
+		context->httpVersion = g_Config.GetHTTPVersion(requestedVersion, context->host);
+	}
+	context->priority = priority;
+	context->owner = owner;
+
+	return context;
+}
+
+void HTTPRequestContext::TakeCallback(IHTTPContext *other)
+{
+	HTTPRequestContext *context = static_cast<HTTPRequestContext *>(other);
+
+	forward = context->forward;
+	value = context->value;
+
+	context->forward = nullptr;
 }
\ No newline at end of file
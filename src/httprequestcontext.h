@@ -36,6 +36,10 @@ public:
 public: // IHTTPContext
 	bool InitCurl();
 	void OnCompleted();
+	bool IsFireAndForget();
+	void ResetForRetry();
+	IHTTPContext *CloneForHedge(const std::string &url);
+	void TakeCallback(IHTTPContext *other);
 
 public:
 	char *body = nullptr;
@@ -44,13 +48,13 @@ public:
 
 private:
 	struct HTTPResponse response;
+	bool hedgeLeg = false;
 
 	const std::string method;
 	const std::string url;
 	struct curl_slist *headers;
 	IChangeableForward *forward;
 	cell_t value;
-	char error[CURL_ERROR_SIZE] = {'\0'};
 	long connectTimeout;
 	long maxRedirects;
 	long timeout;
@@ -0,0 +1,356 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpuploadcontext.h"
+
+static size_t WriteResponseBody(void *body, size_t size, size_t nmemb, void *userdata)
+{
+	size_t total = size * nmemb;
+	struct HTTPResponse *response = (struct HTTPResponse *)userdata;
+
+	char *temp = (char *)realloc(response->body, response->size + total + 1);
+	if (temp == nullptr)
+	{
+		return 0;
+	}
+
+	response->body = temp;
+	memcpy(&(response->body[response->size]), body, total);
+	response->size += total;
+	response->body[response->size] = '\0';
+
+	return total;
+}
+
+static size_t ReceiveResponseHeader(char *buffer, size_t size, size_t nmemb, void *userdata)
+{
+	size_t total = size * nmemb;
+	struct HTTPResponse *response = (struct HTTPResponse *)userdata;
+
+	char header[CURL_MAX_HTTP_HEADER] = {'\0'};
+	strncat(header, buffer, total - 2); // Strip CRLF
+
+	const char *match = strstr(header, ": ");
+	if (match == nullptr)
+	{
+		return total;
+	}
+
+	std::string name(header, match - header);
+	std::string value(match + 2);
+
+	for (size_t i = 0; i < name.size(); i++)
+	{
+		name[i] = tolower(name[i]);
+	}
+
+	response->headers.replace(name.c_str(), std::move(value));
+
+	return total;
+}
+
+static size_t ReadRequestStream(char *buffer, size_t size, size_t nmemb, void *userdata)
+{
+	UploadStream *stream = (UploadStream *)userdata;
+	return stream->Read(buffer, size * nmemb);
+}
+
+UploadStream::UploadStream()
+{
+	uv_mutex_init(&mutex);
+}
+
+UploadStream::~UploadStream()
+{
+	uv_mutex_destroy(&mutex);
+}
+
+size_t UploadStream::Write(const char *data, size_t size)
+{
+	uv_mutex_lock(&mutex);
+
+	if (!finished && size > 0)
+	{
+		chunks.emplace_back(data, size);
+		queuedBytes += size;
+	}
+
+	size_t queued = queuedBytes;
+	bool wake = paused;
+	paused = false;
+
+	uv_mutex_unlock(&mutex);
+
+	if (wake)
+	{
+		Resume();
+	}
+
+	return queued;
+}
+
+void UploadStream::Finish()
+{
+	uv_mutex_lock(&mutex);
+
+	finished = true;
+	bool wake = paused;
+	paused = false;
+
+	uv_mutex_unlock(&mutex);
+
+	/* The transfer has to see the end of the stream */
+	if (wake)
+	{
+		Resume();
+	}
+}
+
+size_t UploadStream::GetQueuedBytes()
+{
+	uv_mutex_lock(&mutex);
+	size_t queued = queuedBytes;
+	uv_mutex_unlock(&mutex);
+
+	return queued;
+}
+
+size_t UploadStream::Read(char *buffer, size_t size)
+{
+	uv_mutex_lock(&mutex);
+
+	size_t total = 0;
+	while (total < size && !chunks.empty())
+	{
+		std::string &chunk = chunks.front();
+
+		size_t length = std::min(size - total, chunk.size() - chunkOffset);
+		memcpy(&buffer[total], &chunk[chunkOffset], length);
+		total += length;
+		chunkOffset += length;
+
+		if (chunkOffset == chunk.size())
+		{
+			chunks.pop_front();
+			chunkOffset = 0;
+		}
+	}
+
+	queuedBytes -= total;
+
+	/* Wait for the plugin to write more, or end the body once it has finished */
+	if (total == 0 && !finished)
+	{
+		paused = true;
+		uv_mutex_unlock(&mutex);
+		return CURL_READFUNC_PAUSE;
+	}
+
+	uv_mutex_unlock(&mutex);
+
+	return total;
+}
+
+void UploadStream::Attach(CURL *curl)
+{
+	this->curl = curl;
+}
+
+void UploadStream::Detach()
+{
+	curl = nullptr;
+}
+
+void UploadStream::Resume()
+{
+	std::shared_ptr<UploadStream> stream = shared_from_this();
+	g_RipExt.RunOnLoop([stream]() {
+		/* The transfer may have completed in the meantime */
+		if (stream->curl != nullptr)
+		{
+			curl_easy_pause(stream->curl, CURLPAUSE_CONT);
+		}
+	});
+}
+
+HTTPUploadContext::HTTPUploadContext(const std::string &url, const std::vector<MultipartPart> &parts, std::shared_ptr<UploadStream> stream,
+									 struct curl_slist *headers, IChangeableForward *forward, cell_t value,
+									 long connectTimeout, long maxRedirects, long timeout, curl_off_t maxSendSpeed, curl_off_t maxRecvSpeed,
+									 bool useBasicAuth, const std::string &username, const std::string &password, const std::string &proxy)
+	: url(url), parts(parts), stream(stream), headers(headers), forward(forward), value(value),
+	  connectTimeout(connectTimeout), maxRedirects(maxRedirects), timeout(timeout), maxSendSpeed(maxSendSpeed),
+	  maxRecvSpeed(maxRecvSpeed), useBasicAuth(useBasicAuth), username(username), password(password), proxy(proxy)
+{
+}
+
+HTTPUploadContext::~HTTPUploadContext()
+{
+	forwards->ReleaseForward(forward);
+
+	curl_easy_cleanup(curl);
+	curl_mime_free(mime);
+	curl_slist_free_all(headers);
+	free(response.body);
+}
+
+bool HTTPUploadContext::InitCurl()
+{
+	curl = curl_easy_init();
+	if (curl == nullptr)
+	{
+		smutils->LogError(myself, "Could not initialize cURL session.");
+		return false;
+	}
+
+	if (stream)
+	{
+		/* A stream can only be read once, so it can't be retried */
+		retryPolicy = RetryPolicy();
+
+		stream->Attach(curl);
+
+		curl_easy_setopt(curl, CURLOPT_POST, 1L);
+		curl_easy_setopt(curl, CURLOPT_READDATA, stream.get());
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, &ReadRequestStream);
+	}
+	else
+	{
+		/* Files are streamed from disk by libcurl, and rewound when the request is retried */
+		mime = curl_mime_init(curl);
+
+		for (const MultipartPart &part : parts)
+		{
+			curl_mimepart *field = curl_mime_addpart(mime);
+			curl_mime_name(field, part.name.c_str());
+
+			if (part.isFile)
+			{
+				if (curl_mime_filedata(field, part.path.c_str()) != CURLE_OK)
+				{
+					smutils->LogError(myself, "Could not open file %s.", part.path.c_str());
+					return false;
+				}
+				if (!part.filename.empty())
+				{
+					curl_mime_filename(field, part.filename.c_str());
+				}
+			}
+			else
+			{
+				curl_mime_data(field, part.value.c_str(), part.value.size());
+			}
+
+			if (!part.contentType.empty())
+			{
+				curl_mime_type(field, part.contentType.c_str());
+			}
+		}
+
+		curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
+	}
+
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+	curl_easy_setopt(curl, CURLOPT_CAINFO, g_RipExt.caBundlePath);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connectTimeout);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &ReceiveResponseHeader);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, maxRedirects);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, this);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+	curl_easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, SM_RIPEXT_UPLOAD_BUFFER_SIZE);
+	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, SM_RIPEXT_USER_AGENT);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &WriteResponseBody);
+
+	SetSpeedLimits(maxRecvSpeed, maxSendSpeed);
+
+	if (useBasicAuth)
+	{
+		curl_easy_setopt(curl, CURLOPT_USERNAME, username.c_str());
+		curl_easy_setopt(curl, CURLOPT_PASSWORD, password.c_str());
+	}
+	if (!proxy.empty())
+	{
+		curl_easy_setopt(curl, CURLOPT_PROXY, proxy.c_str());
+	}
+
+	if (httpVersion != CURL_HTTP_VERSION_NONE)
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, httpVersion);
+	}
+
+#ifdef DEBUG
+	curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+#endif
+
+	return true;
+}
+
+void HTTPUploadContext::OnCompleted()
+{
+	/* Return early if the plugin was unloaded while the thread was running */
+	if (forward->GetFunctionCount() == 0)
+	{
+		return;
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status);
+
+	HandleError err;
+	HandleSecurity sec(nullptr, myself->GetIdentity());
+	Handle_t hndlResponse = handlesys->CreateHandleEx(htHTTPResponse, &response, &sec, nullptr, &err);
+	if (hndlResponse == BAD_HANDLE)
+	{
+		smutils->LogError(myself, "Could not create HTTP response handle (error %d)", err);
+		return;
+	}
+
+	forward->PushCell(hndlResponse);
+	forward->PushCell(value);
+	forward->PushString(error);
+	forward->Execute(nullptr);
+
+	handlesys->FreeHandle(hndlResponse, &sec);
+	handlesys->FreeHandle(response.hndlData, &sec);
+}
+
+void HTTPUploadContext::ResetForRetry()
+{
+	free(response.body);
+	response.body = nullptr;
+	response.size = 0;
+	response.headers.clear();
+}
+
+void HTTPUploadContext::OnLoopCompleted(CURLcode result)
+{
+	/* Detach on the event loop thread, so a pending resume can't touch the handle once it is freed */
+	if (stream)
+	{
+		stream->Detach();
+	}
+}
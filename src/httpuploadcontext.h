@@ -0,0 +1,110 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_HTTPUPLOADCONTEXT_H_
+#define SM_RIPEXT_HTTPUPLOADCONTEXT_H_
+
+#include "extension.h"
+#include <deque>
+
+struct MultipartPart
+{
+	std::string name;
+	std::string value;
+	std::string path;
+	std::string filename;
+	std::string contentType;
+	bool isFile;
+};
+
+/*
+ * Request body written by a plugin while the request is running. Chunks are
+ * queued on the game thread and read by libcurl on the event loop thread,
+ * which pauses the transfer while the queue is empty.
+ */
+class UploadStream : public std::enable_shared_from_this<UploadStream>
+{
+public:
+	UploadStream();
+	~UploadStream();
+
+	/* Called on the game thread, returns the number of bytes still queued */
+	size_t Write(const char *data, size_t size);
+	void Finish();
+	size_t GetQueuedBytes();
+
+	/* Called on the event loop thread */
+	size_t Read(char *buffer, size_t size);
+	void Attach(CURL *curl);
+	void Detach();
+
+private:
+	void Resume();
+
+private:
+	uv_mutex_t mutex;
+	std::deque<std::string> chunks;
+	size_t chunkOffset = 0;
+	size_t queuedBytes = 0;
+	bool finished = false;
+	bool paused = false;
+
+	/* Only used on the event loop thread */
+	CURL *curl = nullptr;
+};
+
+class HTTPUploadContext : public IHTTPContext
+{
+public:
+	HTTPUploadContext(const std::string &url, const std::vector<MultipartPart> &parts, std::shared_ptr<UploadStream> stream,
+					  struct curl_slist *headers, IChangeableForward *forward, cell_t value,
+					  long connectTimeout, long maxRedirects, long timeout, curl_off_t maxSendSpeed, curl_off_t maxRecvSpeed,
+					  bool useBasicAuth, const std::string &username, const std::string &password, const std::string &proxy);
+	~HTTPUploadContext();
+
+public: // IHTTPContext
+	bool InitCurl();
+	void OnCompleted();
+	void ResetForRetry();
+	void OnLoopCompleted(CURLcode result);
+
+private:
+	struct HTTPResponse response;
+	curl_mime *mime = nullptr;
+
+	const std::string url;
+	const std::vector<MultipartPart> parts;
+	std::shared_ptr<UploadStream> stream;
+	struct curl_slist *headers;
+	IChangeableForward *forward;
+	cell_t value;
+	long connectTimeout;
+	long maxRedirects;
+	long timeout;
+	curl_off_t maxSendSpeed;
+	curl_off_t maxRecvSpeed;
+	bool useBasicAuth;
+	const std::string username;
+	const std::string password;
+	const std::string proxy;
+};
+
+#endif // SM_RIPEXT_HTTPUPLOADCONTEXT_H_
@@ -0,0 +1,279 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log.h"
+#include "config.h"
+#include <time.h>
+
+/* How often the background writer wakes up to write pending messages */
+#define WRITER_INTERVAL 100
+
+Logger g_Logger;
+
+Logger::Logger()
+{
+	for (size_t i = 0; i < LOG_RING_SIZE; i++)
+	{
+		ring[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+void Logger::Init()
+{
+	const std::string &path = g_Config.GetLogFile();
+	if (path.empty())
+	{
+		return;
+	}
+
+	char realpath[PLATFORM_MAX_PATH];
+	smutils->BuildPath(Path_SM, realpath, sizeof(realpath), "%s", path.c_str());
+
+	file = fopen(realpath, "a");
+	if (file == nullptr)
+	{
+		smutils->LogError(myself, "Could not open log file %s, logging to the SourceMod logs instead", realpath);
+		return;
+	}
+
+	running = true;
+	uv_thread_create(&writer, &WriterThread, this);
+}
+
+void Logger::Shutdown()
+{
+	if (file == nullptr)
+	{
+		Flush();
+		return;
+	}
+
+	running = false;
+	uv_thread_join(&writer);
+
+	WriteEntries(file);
+	fclose(file);
+	file = nullptr;
+}
+
+void Logger::Log(LogLevel level, const char *format, va_list ap)
+{
+	if (level > g_Config.GetOption(HTTPOption_LogLevel))
+	{
+		return;
+	}
+
+	uint32_t suppressedBefore;
+	if (!AllowSite(format, &suppressedBefore))
+	{
+		suppressed++;
+		return;
+	}
+
+	/* Claim a slot, or drop the message when the ring is full */
+	LogEntry *entry;
+	size_t pos = enqueuePos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		entry = &ring[pos & (LOG_RING_SIZE - 1)];
+		size_t sequence = entry->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+		if (diff == 0)
+		{
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			dropped++;
+			return;
+		}
+		else
+		{
+			pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	entry->level = level;
+
+	int length = vsnprintf(entry->message, sizeof(entry->message), format, ap);
+	if (suppressedBefore > 0 && length >= 0 && (size_t)length < sizeof(entry->message))
+	{
+		snprintf(&entry->message[length], sizeof(entry->message) - length, " (%u similar messages suppressed)", suppressedBefore);
+	}
+
+	entry->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void Logger::Flush()
+{
+	if (file == nullptr)
+	{
+		WriteEntries(nullptr);
+	}
+}
+
+bool Logger::ParseLevel(const char *value, long *level)
+{
+	static const char *levels[] = {"error", "warning", "info", "debug"};
+
+	for (long i = 0; i < (long)(sizeof(levels) / sizeof(levels[0])); i++)
+	{
+		if (strcmp(value, levels[i]) == 0)
+		{
+			*level = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Logger::AllowSite(const char *format, uint32_t *suppressedBefore)
+{
+	*suppressedBefore = 0;
+
+	long limit = g_Config.GetOption(HTTPOption_LogRateLimit);
+	if (limit <= 0)
+	{
+		return true;
+	}
+
+	/* Find or claim the slot for this call site, sites are never released */
+	LogSite *site = nullptr;
+	size_t start = ((uintptr_t)format >> 3) & (LOG_MAX_SITES - 1);
+	for (size_t i = 0; i < LOG_MAX_SITES; i++)
+	{
+		LogSite *candidate = &sites[(start + i) & (LOG_MAX_SITES - 1)];
+		const char *current = candidate->format.load(std::memory_order_acquire);
+
+		/* A failed exchange loads the format that won the slot */
+		if (current == nullptr && candidate->format.compare_exchange_strong(current, format))
+		{
+			site = candidate;
+			break;
+		}
+		if (current == format)
+		{
+			site = candidate;
+			break;
+		}
+	}
+
+	/* Too many call sites to track, let the message through */
+	if (site == nullptr)
+	{
+		return true;
+	}
+
+	/* Each call site gets a number of messages per second */
+	uint64_t now = uv_hrtime() / 1000000000;
+	uint64_t windowStart = site->windowStart.load(std::memory_order_relaxed);
+	if (now != windowStart && site->windowStart.compare_exchange_strong(windowStart, now))
+	{
+		site->count = 0;
+		*suppressedBefore = site->suppressed.exchange(0);
+	}
+
+	if (site->count++ >= (uint32_t)limit)
+	{
+		site->suppressed++;
+		return false;
+	}
+
+	return true;
+}
+
+static void WriteLine(FILE *file, LogLevel level, const char *message)
+{
+	static const char *levels[] = {"ERROR", "WARNING", "INFO", "DEBUG"};
+
+	char date[32];
+	time_t t = time(nullptr);
+	strftime(date, sizeof(date), "%m/%d/%Y - %H:%M:%S", localtime(&t));
+
+	fprintf(file, "L %s: [%s] %s\n", date, levels[level], message);
+}
+
+void Logger::WriteEntries(FILE *file)
+{
+	for (;;)
+	{
+		LogEntry *entry = &ring[dequeuePos & (LOG_RING_SIZE - 1)];
+		if (entry->sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+		{
+			break;
+		}
+
+		if (file != nullptr)
+		{
+			WriteLine(file, entry->level, entry->message);
+		}
+		else if (entry->level <= LogLevel_Warning)
+		{
+			smutils->LogError(myself, "%s", entry->message);
+		}
+		else
+		{
+			smutils->LogMessage(myself, "%s", entry->message);
+		}
+
+		entry->sequence.store(dequeuePos + LOG_RING_SIZE, std::memory_order_release);
+		dequeuePos++;
+	}
+
+	uint64_t droppedNow = dropped.load();
+	if (droppedNow != reportedDropped)
+	{
+		char message[128];
+		snprintf(message, sizeof(message), "%llu log messages dropped, the log buffer was full", (unsigned long long)(droppedNow - reportedDropped));
+
+		if (file != nullptr)
+		{
+			WriteLine(file, LogLevel_Warning, message);
+		}
+		else
+		{
+			smutils->LogError(myself, "%s", message);
+		}
+
+		reportedDropped = droppedNow;
+	}
+
+	if (file != nullptr)
+	{
+		fflush(file);
+	}
+}
+
+void Logger::WriterThread(void *data)
+{
+	Logger *logger = (Logger *)data;
+
+	while (logger->running)
+	{
+		logger->WriteEntries(logger->file);
+		uv_sleep(WRITER_INTERVAL);
+	}
+}
@@ -0,0 +1,105 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_LOG_H_
+#define SM_RIPEXT_LOG_H_
+
+#include "extension.h"
+#include <atomic>
+#include <stdarg.h>
+
+/* Must be a power of two */
+#define LOG_RING_SIZE 256
+#define LOG_MESSAGE_SIZE 1024
+#define LOG_MAX_SITES 256
+
+enum LogLevel
+{
+	LogLevel_Error = 0,
+	LogLevel_Warning,
+	LogLevel_Info,
+	LogLevel_Debug,
+};
+
+struct LogEntry
+{
+	std::atomic<size_t> sequence;
+	LogLevel level;
+	char message[LOG_MESSAGE_SIZE];
+};
+
+/* Call sites are identified by their format string */
+struct LogSite
+{
+	std::atomic<const char *> format{nullptr};
+	std::atomic<uint64_t> windowStart{0};
+	std::atomic<uint32_t> count{0};
+	std::atomic<uint32_t> suppressed{0};
+};
+
+/*
+ * Messages are formatted straight into a fixed-size lock-free ring by the
+ * thread that logs them, and written out in batches either on the game
+ * thread or by a background thread to a dedicated log file.
+ */
+class Logger
+{
+public:
+	Logger();
+
+	void Init();
+	void Shutdown();
+
+	/* Safe to call from any thread */
+	void Log(LogLevel level, const char *format, va_list ap);
+
+	/* Writes out pending messages when logging through SourceMod, called on the game thread */
+	void Flush();
+
+	uint64_t GetDropped() const { return dropped; }
+	uint64_t GetSuppressed() const { return suppressed; }
+
+	static bool ParseLevel(const char *value, long *level);
+
+private:
+	bool AllowSite(const char *format, uint32_t *suppressedBefore);
+	void WriteEntries(FILE *file);
+	static void WriterThread(void *data);
+
+private:
+	LogEntry ring[LOG_RING_SIZE];
+	std::atomic<size_t> enqueuePos{0};
+	size_t dequeuePos = 0;
+
+	LogSite sites[LOG_MAX_SITES];
+
+	std::atomic<uint64_t> dropped{0};
+	std::atomic<uint64_t> suppressed{0};
+	uint64_t reportedDropped = 0;
+
+	FILE *file = nullptr;
+	uv_thread_t writer;
+	std::atomic<bool> running{false};
+};
+
+extern Logger g_Logger;
+
+#endif // SM_RIPEXT_LOG_H_
@@ -22,7 +22,9 @@
 #ifndef SM_RIPEXT_QUEUE_H_
 #define SM_RIPEXT_QUEUE_H_
 
+#include <list>
 #include <queue>
+#include <unordered_map>
 #include <uv.h>
 
 template <class T>
@@ -72,4 +74,192 @@ private:
 	std::queue<T> queue;
 };
 
+/* Round robin between the owners of the queued items, so one owner cannot monopolise the queue */
+template <class T>
+class FairQueue
+{
+public:
+	void Push(T item, const void *owner)
+	{
+		auto iter = index.find(owner);
+		if (iter == index.end())
+		{
+			buckets.push_back(Bucket{owner, std::queue<T>()});
+			iter = index.emplace(owner, std::prev(buckets.end())).first;
+		}
+
+		iter->second->items.push(item);
+	}
+
+	template <class Blocked>
+	bool Pop(T &item, Blocked blocked)
+	{
+		for (auto bucket = buckets.begin(); bucket != buckets.end(); ++bucket)
+		{
+			if (blocked(bucket->owner))
+			{
+				continue;
+			}
+
+			item = bucket->items.front();
+			bucket->items.pop();
+
+			/* The owner goes to the back of the line */
+			if (bucket->items.empty())
+			{
+				index.erase(bucket->owner);
+				buckets.erase(bucket);
+			}
+			else
+			{
+				buckets.splice(buckets.end(), buckets, bucket);
+			}
+
+			return true;
+		}
+
+		return false;
+	}
+
+	template <class Blocked>
+	bool HasReady(Blocked blocked) const
+	{
+		for (const Bucket &bucket : buckets)
+		{
+			if (!blocked(bucket.owner))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool Empty() const
+	{
+		return buckets.empty();
+	}
+
+private:
+	struct Bucket
+	{
+		const void *owner;
+		std::queue<T> items;
+	};
+
+	std::list<Bucket> buckets;
+	std::unordered_map<const void *, typename std::list<Bucket>::iterator> index;
+};
+
+/* Weighted round robin over one fair queue per priority, lower priorities are never starved */
+template <class T, int N>
+class PriorityQueue
+{
+public:
+	PriorityQueue(const int (&weights)[N])
+	{
+		uv_mutex_init(&mutex);
+
+		for (int i = 0; i < N; i++)
+		{
+			this->weights[i] = weights[i];
+			this->credits[i] = weights[i];
+			this->paused[i] = false;
+		}
+	}
+
+	~PriorityQueue()
+	{
+		uv_mutex_destroy(&mutex);
+	}
+
+	void Lock()
+	{
+		uv_mutex_lock(&mutex);
+	}
+
+	void Unlock()
+	{
+		uv_mutex_unlock(&mutex);
+	}
+
+	/* Blocked owners keep their items, but are skipped until they are unblocked */
+	template <class Blocked>
+	bool Pop(T &item, Blocked blocked)
+	{
+		if (!HasReady(blocked))
+		{
+			return false;
+		}
+
+		for (;;)
+		{
+			for (int i = 0; i < N; i++)
+			{
+				if (credits[i] > 0 && !paused[i] && queues[i].Pop(item, blocked))
+				{
+					credits[i]--;
+					return true;
+				}
+			}
+
+			/* Every ready priority used up its share, start a new round */
+			for (int i = 0; i < N; i++)
+			{
+				credits[i] = weights[i];
+			}
+		}
+	}
+
+	bool Pop(T &item)
+	{
+		return Pop(item, [](const void *) { return false; });
+	}
+
+	void Push(T item, int priority, const void *owner)
+	{
+		queues[priority].Push(item, owner);
+	}
+
+	/* Paused priorities keep their items, but Pop skips them */
+	void SetPaused(int priority, bool paused)
+	{
+		this->paused[priority] = paused;
+	}
+
+	template <class Blocked>
+	bool HasReady(Blocked blocked) const
+	{
+		for (int i = 0; i < N; i++)
+		{
+			if (!paused[i] && queues[i].HasReady(blocked))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool Empty() const
+	{
+		for (int i = 0; i < N; i++)
+		{
+			if (!paused[i] && !queues[i].Empty())
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+private:
+	uv_mutex_t mutex;
+	FairQueue<T> queues[N];
+	int weights[N];
+	int credits[N];
+	bool paused[N];
+};
+
 #endif // SM_RIPEXT_QUEUE_H_
@@ -0,0 +1,117 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "quota.h"
+#include "config.h"
+
+PluginQuotas g_PluginQuotas;
+
+void PluginQuotas::Init()
+{
+	plsys->AddPluginsListener(this);
+}
+
+void PluginQuotas::Shutdown()
+{
+	plsys->RemovePluginsListener(this);
+	plugins.clear();
+}
+
+std::shared_ptr<PluginUsage> PluginQuotas::GetUsage(IPluginContext *pContext)
+{
+	IdentityToken_t *identity = pContext->GetIdentity();
+
+	auto iter = plugins.find(identity);
+	if (iter != plugins.end())
+	{
+		return iter->second;
+	}
+
+	std::shared_ptr<PluginUsage> usage = std::make_shared<PluginUsage>();
+
+	IPlugin *plugin = plsys->FindPluginByContext(pContext->GetContext());
+	usage->name = (plugin != nullptr) ? plugin->GetFilename() : "<unknown>";
+
+	plugins.emplace(identity, usage);
+
+	return usage;
+}
+
+bool PluginQuotas::OnQueued(PluginUsage *usage)
+{
+	usage->requests++;
+
+	long maxQueued = g_Config.GetOption(HTTPOption_MaxPluginQueued);
+	if (maxQueued > 0 && usage->queued >= maxQueued)
+	{
+		usage->rejected++;
+		return false;
+	}
+
+	usage->queued++;
+	return true;
+}
+
+bool PluginQuotas::IsBlocked(const PluginUsage *usage) const
+{
+	long maxInFlight = g_Config.GetOption(HTTPOption_MaxPluginInFlight);
+
+	return usage != nullptr && maxInFlight > 0 && usage->inFlight >= maxInFlight;
+}
+
+void PluginQuotas::OnAdmitted(PluginUsage *usage)
+{
+	usage->queued--;
+	usage->inFlight++;
+}
+
+bool PluginQuotas::OnFinished(PluginUsage *usage)
+{
+	usage->completed++;
+
+	/* Tell the caller when this frees up a slot for a blocked plugin */
+	return usage->inFlight-- == g_Config.GetOption(HTTPOption_MaxPluginInFlight);
+}
+
+void PluginQuotas::Print()
+{
+	if (plugins.empty())
+	{
+		return;
+	}
+
+	rootconsole->ConsolePrint("HTTP requests per plugin:");
+
+	for (const auto &entry : plugins)
+	{
+		const PluginUsage *usage = entry.second.get();
+
+		rootconsole->ConsolePrint("  %-32s %llu requests, %llu completed, %llu rejected, %ld queued, %ld in flight",
+			usage->name.c_str(), (unsigned long long)usage->requests.load(), (unsigned long long)usage->completed.load(),
+			(unsigned long long)usage->rejected.load(), usage->queued.load(), usage->inFlight.load());
+	}
+}
+
+void PluginQuotas::OnPluginUnloaded(IPlugin *plugin)
+{
+	/* Requests still in flight keep the usage alive until they complete */
+	plugins.erase(plugin->GetIdentity());
+}
@@ -0,0 +1,69 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_QUOTA_H_
+#define SM_RIPEXT_QUOTA_H_
+
+#include "extension.h"
+#include <atomic>
+#include <map>
+
+/* Usage of a single plugin, shared between the plugin's requests and outlives the plugin */
+struct PluginUsage
+{
+	std::string name;
+
+	std::atomic<long> queued{0};
+	std::atomic<long> inFlight{0};
+
+	std::atomic<uint64_t> requests{0};
+	std::atomic<uint64_t> completed{0};
+	std::atomic<uint64_t> rejected{0};
+};
+
+class PluginQuotas : public IPluginsListener
+{
+public:
+	void Init();
+	void Shutdown();
+
+	std::shared_ptr<PluginUsage> GetUsage(IPluginContext *pContext);
+
+	/* Called on the game thread when a request is queued, returns false if the plugin is over its quota */
+	bool OnQueued(PluginUsage *usage);
+
+	/* Called on the event loop thread when a transfer enters and leaves the multi handle */
+	bool IsBlocked(const PluginUsage *usage) const;
+	void OnAdmitted(PluginUsage *usage);
+	bool OnFinished(PluginUsage *usage);
+
+	void Print();
+
+public: // IPluginsListener
+	void OnPluginUnloaded(IPlugin *plugin);
+
+private:
+	std::map<IdentityToken_t *, std::shared_ptr<PluginUsage>> plugins;
+};
+
+extern PluginQuotas g_PluginQuotas;
+
+#endif // SM_RIPEXT_QUOTA_H_
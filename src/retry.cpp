@@ -0,0 +1,232 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "retry.h"
+#include "stats.h"
+
+RetryManager g_RetryManager;
+
+struct RetryTimer
+{
+	uv_timer_t timer;
+	IHTTPContext *context;
+};
+
+RetryManager::RetryManager() : random(std::random_device()())
+{
+}
+
+bool RetryManager::AllowRequest(IHTTPContext *context)
+{
+	if (!context->retryPolicy.Enabled() || context->host.empty())
+	{
+		return true;
+	}
+
+	auto iter = circuits.find(context->host);
+	if (iter == circuits.end() || iter->second.openUntil == 0)
+	{
+		return true;
+	}
+
+	CircuitState &circuit = iter->second;
+
+	/* Once the circuit has been open long enough, let a single request through as a probe */
+	if (!circuit.probing && uv_now(g_Loop) >= circuit.openUntil)
+	{
+		circuit.probing = true;
+		return true;
+	}
+
+	snprintf(context->error, sizeof(context->error), "Circuit breaker open for host %s", context->host.c_str());
+	g_Stats.http.circuitRejected++;
+
+	return false;
+}
+
+/* Unlike AllowRequest this neither rejects the request nor uses up the probe */
+bool RetryManager::IsOpen(const std::string &host) const
+{
+	auto iter = circuits.find(host);
+	if (iter == circuits.end())
+	{
+		return false;
+	}
+
+	return iter->second.openUntil > uv_now(g_Loop);
+}
+
+bool RetryManager::ScheduleRetry(IHTTPContext *context, CURLcode result)
+{
+	if (!context->retryPolicy.Enabled())
+	{
+		return false;
+	}
+
+	long status = 0;
+	curl_easy_getinfo(context->curl, CURLINFO_RESPONSE_CODE, &status);
+
+	bool retryable = IsRetryable(context, result, status);
+	RecordResult(context, retryable);
+
+	if (!retryable || context->attempt >= context->retryPolicy.maxAttempts)
+	{
+		return false;
+	}
+
+	/* A backend that was just declared down is not worth another attempt */
+	if (IsOpen(context->host))
+	{
+		return false;
+	}
+
+	uint64_t delay = GetDelay(context);
+	if (delay == 0)
+	{
+		return false;
+	}
+
+	context->attempt++;
+	context->error[0] = '\0';
+	context->ResetForRetry();
+
+	RetryTimer *retry = new RetryTimer;
+	retry->context = context;
+	retry->timer.data = retry;
+
+	uv_timer_init(g_Loop, &retry->timer);
+	uv_timer_start(&retry->timer, &OnRetryTimer, delay, 0);
+
+	g_Stats.http.retries++;
+
+	return true;
+}
+
+bool RetryManager::IsRetryable(IHTTPContext *context, CURLcode result, long status)
+{
+	const RetryPolicy &policy = context->retryPolicy;
+
+	switch (result)
+	{
+	case CURLE_OK:
+		break;
+	case CURLE_COULDNT_RESOLVE_PROXY:
+	case CURLE_COULDNT_RESOLVE_HOST:
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_SSL_CONNECT_ERROR:
+		return (policy.retryOn & RetryOn_Connect) != 0;
+	case CURLE_OPERATION_TIMEDOUT:
+		return (policy.retryOn & RetryOn_Timeout) != 0;
+	case CURLE_PARTIAL_FILE:
+	case CURLE_GOT_NOTHING:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_HTTP2:
+	case CURLE_HTTP2_STREAM:
+		return (policy.retryOn & RetryOn_Transfer) != 0;
+	default:
+		return false;
+	}
+
+	for (long retryStatus : policy.statuses)
+	{
+		if (status == retryStatus)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint64_t RetryManager::GetDelay(IHTTPContext *context)
+{
+	const RetryPolicy &policy = context->retryPolicy;
+
+	/* Exponential backoff with equal jitter, so clients that failed together do not retry together */
+	uint64_t cap = policy.baseDelay;
+	for (int i = 1; i < context->attempt && cap < (uint64_t)policy.maxDelay; i++)
+	{
+		cap *= 2;
+	}
+	if (cap > (uint64_t)policy.maxDelay)
+	{
+		cap = policy.maxDelay;
+	}
+
+	std::uniform_int_distribution<uint64_t> jitter(0, cap / 2);
+	uint64_t delay = cap - cap / 2 + jitter(random);
+
+	/* Honor Retry-After from 429 and 503 responses, unless it asks us to wait longer than we are willing to */
+	curl_off_t retryAfter = 0;
+	if (curl_easy_getinfo(context->curl, CURLINFO_RETRY_AFTER, &retryAfter) == CURLE_OK && retryAfter > 0)
+	{
+		if ((uint64_t)retryAfter * 1000 > (uint64_t)policy.maxDelay)
+		{
+			return 0;
+		}
+
+		delay = std::max(delay, (uint64_t)retryAfter * 1000);
+	}
+
+	return std::max(delay, (uint64_t)1);
+}
+
+void RetryManager::RecordResult(IHTTPContext *context, bool failed)
+{
+	if (!context->retryPolicy.Enabled() || context->host.empty())
+	{
+		return;
+	}
+
+	CircuitState &circuit = circuits[context->host];
+
+	if (!failed)
+	{
+		circuit = CircuitState();
+		return;
+	}
+
+	circuit.probing = false;
+	if (++circuit.failures >= CIRCUIT_FAILURE_THRESHOLD)
+	{
+		if (circuit.openUntil == 0)
+		{
+			g_RipExt.LogError("Circuit breaker opened for host %s after %d failures", context->host.c_str(), circuit.failures);
+		}
+
+		circuit.openUntil = uv_now(g_Loop) + CIRCUIT_OPEN_TIME;
+	}
+}
+
+void RetryManager::OnRetryTimer(uv_timer_t *handle)
+{
+	RetryTimer *retry = (RetryTimer *)handle->data;
+
+	curl_multi_add_handle(g_Curl, retry->context->curl);
+
+	uv_close((uv_handle_t *)&retry->timer, &OnTimerClosed);
+}
+
+void RetryManager::OnTimerClosed(uv_handle_t *handle)
+{
+	delete (RetryTimer *)handle->data;
+}
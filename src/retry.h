@@ -0,0 +1,65 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_RETRY_H_
+#define SM_RIPEXT_RETRY_H_
+
+#include "extension.h"
+#include <map>
+#include <random>
+
+/* Circuit breaker defaults */
+#define CIRCUIT_FAILURE_THRESHOLD 5
+#define CIRCUIT_OPEN_TIME 30000
+
+class RetryManager
+{
+public:
+	RetryManager();
+
+	/* All functions must be called on the event loop thread */
+	bool AllowRequest(IHTTPContext *context);
+	bool IsOpen(const std::string &host) const;
+	bool ScheduleRetry(IHTTPContext *context, CURLcode result);
+
+private:
+	bool IsRetryable(IHTTPContext *context, CURLcode result, long status);
+	uint64_t GetDelay(IHTTPContext *context);
+	void RecordResult(IHTTPContext *context, bool failed);
+
+	static void OnRetryTimer(uv_timer_t *handle);
+	static void OnTimerClosed(uv_handle_t *handle);
+
+private:
+	struct CircuitState
+	{
+		int failures = 0;
+		uint64_t openUntil = 0;
+		bool probing = false;
+	};
+
+	std::map<std::string, CircuitState> circuits;
+	std::mt19937 random;
+};
+
+extern RetryManager g_RetryManager;
+
+#endif // SM_RIPEXT_RETRY_H_
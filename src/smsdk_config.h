@@ -46,14 +46,14 @@
  * @brief Sets whether or not this plugin required Metamod.
  * NOTE: Uncomment to enable, comment to disable.
  */
-// #define SMEXT_CONF_METAMOD
+#define SMEXT_CONF_METAMOD
 
 /** Enable interfaces you want to use here by uncommenting lines */
 #define SMEXT_ENABLE_FORWARDSYS
 #define SMEXT_ENABLE_HANDLESYS
 // #define SMEXT_ENABLE_PLAYERHELPERS
 // #define SMEXT_ENABLE_DBMANAGER
-// #define SMEXT_ENABLE_GAMECONF
+#define SMEXT_ENABLE_GAMECONF
 // #define SMEXT_ENABLE_MEMUTILS
 // #define SMEXT_ENABLE_GAMEHELPERS
 // #define SMEXT_ENABLE_TIMERSYS
@@ -61,11 +61,11 @@
 // #define SMEXT_ENABLE_LIBSYS
 // #define SMEXT_ENABLE_MENUS
 // #define SMEXT_ENABLE_ADTFACTORY
-// #define SMEXT_ENABLE_PLUGINSYS
+#define SMEXT_ENABLE_PLUGINSYS
 // #define SMEXT_ENABLE_ADMINSYS
-// #define SMEXT_ENABLE_TEXTPARSERS
+#define SMEXT_ENABLE_TEXTPARSERS
 // #define SMEXT_ENABLE_USERMSGS
 // #define SMEXT_ENABLE_TRANSLATOR
-// #define SMEXT_ENABLE_ROOTCONSOLEMENU
+#define SMEXT_ENABLE_ROOTCONSOLEMENU
 
 #endif // _INCLUDE_SOURCEMOD_EXTENSION_CONFIG_H_
@@ -0,0 +1,190 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+#include "dispatch.h"
+#include "log.h"
+#include <algorithm>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+RipExtStats g_Stats;
+
+void RipExtStats::RecordTransfer(IHTTPContext *context, CURLcode result)
+{
+	long status = 0;
+	curl_off_t sent = 0;
+	curl_off_t received = 0;
+
+	curl_easy_getinfo(context->curl, CURLINFO_RESPONSE_CODE, &status);
+	curl_easy_getinfo(context->curl, CURLINFO_SIZE_UPLOAD_T, &sent);
+	curl_easy_getinfo(context->curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+
+	bool failed = (result != CURLE_OK || status >= 400);
+
+	http.completed++;
+	http.bytesSent += sent;
+	http.bytesReceived += received;
+
+	if (failed)
+	{
+		http.failed++;
+	}
+
+	if (context->queuedTime != 0)
+	{
+		uint64_t latency = (uv_hrtime() - context->queuedTime) / 1000;
+		http.latencyTotal += latency;
+
+		uint64_t max = http.latencyMax.load();
+		while (latency > max && !http.latencyMax.compare_exchange_weak(max, latency))
+		{
+		}
+	}
+
+	if (context->IsFireAndForget())
+	{
+		if (failed)
+		{
+			http.fireAndForgetFailed++;
+		}
+		else
+		{
+			http.fireAndForgetCompleted++;
+		}
+	}
+}
+
+void RipExtStats::RecordThread(ThreadStats &stats, ThreadSample &last, uint64_t excludedTime)
+{
+	ThreadSample now;
+	now.excludedTime = excludedTime;
+
+#if defined WIN32
+	/* Windows does not count context switches per thread */
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+	{
+		return;
+	}
+
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	now.cpuTime = (k.QuadPart + u.QuadPart) / 10;
+#elif defined __linux__
+	struct rusage usage;
+	if (getrusage(RUSAGE_THREAD, &usage) != 0)
+	{
+		return;
+	}
+
+	now.cpuTime = (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+	now.contextSwitches = usage.ru_nvcsw + usage.ru_nivcsw;
+#else
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+	{
+		return;
+	}
+
+	now.cpuTime = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+
+	/* The excluded time is wall time, so it may exceed the CPU time it overlaps with */
+	uint64_t cpuTime = now.cpuTime - last.cpuTime;
+	stats.cpuTime += cpuTime - std::min(cpuTime, now.excludedTime - last.excludedTime);
+	stats.contextSwitches += now.contextSwitches - last.contextSwitches;
+	last = now;
+}
+
+void RipExtStats::Print()
+{
+	rootconsole->ConsolePrint("HTTP:");
+	rootconsole->ConsolePrint("  Queued:              %llu", (unsigned long long)http.queued.load());
+	rootconsole->ConsolePrint("  Completed:           %llu", (unsigned long long)http.completed.load());
+	rootconsole->ConsolePrint("  Failed:              %llu", (unsigned long long)http.failed.load());
+	rootconsole->ConsolePrint("  Bytes sent:          %llu", (unsigned long long)http.bytesSent.load());
+	rootconsole->ConsolePrint("  Bytes received:      %llu", (unsigned long long)http.bytesReceived.load());
+	rootconsole->ConsolePrint("  Retries:             %llu", (unsigned long long)http.retries.load());
+	rootconsole->ConsolePrint("  Circuit rejections:  %llu", (unsigned long long)http.circuitRejected.load());
+	rootconsole->ConsolePrint("  Busy time:           %.3fs", http.busyTime.load() / 1000000.0);
+	uint64_t completed = http.completed.load();
+	rootconsole->ConsolePrint("  Latency:             %.3fms average, %.3fms max",
+		completed ? http.latencyTotal.load() / 1000.0 / completed : 0.0, http.latencyMax.load() / 1000.0);
+	uint64_t hedgeEligible = http.hedgeEligible.load();
+	uint64_t hedgeStarted = http.hedgeStarted.load();
+	rootconsole->ConsolePrint("  Hedged requests:     %llu started for %llu eligible (%.1f%%), %llu won",
+		(unsigned long long)hedgeStarted, (unsigned long long)hedgeEligible,
+		hedgeEligible ? 100.0 * hedgeStarted / hedgeEligible : 0.0, (unsigned long long)http.hedgeWon.load());
+	rootconsole->ConsolePrint("  Fire-and-forget:     %llu completed, %llu failed",
+		(unsigned long long)http.fireAndForgetCompleted.load(), (unsigned long long)http.fireAndForgetFailed.load());
+
+	rootconsole->ConsolePrint("HTTP batchers:");
+	rootconsole->ConsolePrint("  Events:              %llu pushed, %llu dropped",
+		(unsigned long long)batcher.events.load(), (unsigned long long)batcher.eventsDropped.load());
+	rootconsole->ConsolePrint("  Batches:             %llu sent, %llu failed",
+		(unsigned long long)batcher.batchesSent.load(), (unsigned long long)batcher.batchesFailed.load());
+
+	rootconsole->ConsolePrint("WebSocket:");
+	rootconsole->ConsolePrint("  Messages sent:       %llu (%llu bytes)", (unsigned long long)websocket.messagesSent.load(),
+		(unsigned long long)websocket.bytesSent.load());
+	rootconsole->ConsolePrint("  Pool allocations:    %llu", (unsigned long long)websocket.bufferAllocations.load());
+	rootconsole->ConsolePrint("  Messages received:   %llu (%llu bytes)", (unsigned long long)websocket.messagesReceived.load(),
+		(unsigned long long)websocket.bytesReceived.load());
+	rootconsole->ConsolePrint("  Malformed messages:  %llu", (unsigned long long)websocket.malformedMessages.load());
+	rootconsole->ConsolePrint("  Reconnects:          %llu", (unsigned long long)websocket.reconnects.load());
+
+	/* Message sizes before compression compared with what went over the socket, TLS included */
+	uint64_t wireSent = websocket.wireBytesSent.load();
+	uint64_t wireReceived = websocket.wireBytesReceived.load();
+	rootconsole->ConsolePrint("  Wire bytes:          %llu sent (ratio %.2f), %llu received (ratio %.2f)",
+		(unsigned long long)wireSent, wireSent > 0 ? (double)websocket.bytesSent.load() / wireSent : 0.0,
+		(unsigned long long)wireReceived, wireReceived > 0 ? (double)websocket.bytesReceived.load() / wireReceived : 0.0);
+
+	rootconsole->ConsolePrint("Network threads:");
+	if (unifiedLoop)
+	{
+		/* Context switches of the shared thread cannot be told apart */
+		rootconsole->ConsolePrint("  HTTP loop:           %.3fs in the first WebSocket loop", httpThread.cpuTime.load() / 1000000.0);
+	}
+	else
+	{
+		rootconsole->ConsolePrint("  HTTP loop:           %.3fs CPU, %llu context switches", httpThread.cpuTime.load() / 1000000.0,
+			(unsigned long long)httpThread.contextSwitches.load());
+	}
+	rootconsole->ConsolePrint("  WebSocket loops:     %.3fs CPU, %llu context switches", websocketThreads.cpuTime.load() / 1000000.0,
+		(unsigned long long)websocketThreads.contextSwitches.load());
+
+	rootconsole->ConsolePrint("Dispatch:");
+	rootconsole->ConsolePrint("  Fallback dispatches: %llu", (unsigned long long)g_Dispatcher.GetFallbackDispatches());
+	rootconsole->ConsolePrint("  Over budget frames:  %llu", (unsigned long long)g_Dispatcher.GetBudgetExhausted());
+	rootconsole->ConsolePrint("  Event allocations:   %llu", (unsigned long long)g_Dispatcher.GetEventAllocations());
+
+	rootconsole->ConsolePrint("Logging:");
+	rootconsole->ConsolePrint("  Dropped:             %llu", (unsigned long long)g_Logger.GetDropped());
+	rootconsole->ConsolePrint("  Rate limited:        %llu", (unsigned long long)g_Logger.GetSuppressed());
+}
@@ -0,0 +1,111 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * SourceMod REST in Pawn Extension
+ * Copyright 2017-2022 Erik Minekus
+ * =============================================================================
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SM_RIPEXT_STATS_H_
+#define SM_RIPEXT_STATS_H_
+
+#include "extension.h"
+#include <atomic>
+
+/* Counters are written from the network threads and read by the console command */
+struct HTTPStats
+{
+	std::atomic<uint64_t> queued{0};
+	std::atomic<uint64_t> completed{0};
+	std::atomic<uint64_t> failed{0};
+	std::atomic<uint64_t> bytesSent{0};
+	std::atomic<uint64_t> bytesReceived{0};
+	std::atomic<uint64_t> retries{0};
+	std::atomic<uint64_t> circuitRejected{0};
+	std::atomic<uint64_t> hedgeEligible{0};
+	std::atomic<uint64_t> hedgeStarted{0};
+	std::atomic<uint64_t> hedgeWon{0};
+	/* Microseconds during which the event loop had at least one request to finish */
+	std::atomic<uint64_t> busyTime{0};
+	/* Microseconds from queueing requests on the game thread until the event loop completed them */
+	std::atomic<uint64_t> latencyTotal{0};
+	std::atomic<uint64_t> latencyMax{0};
+
+	std::atomic<uint64_t> fireAndForgetCompleted{0};
+	std::atomic<uint64_t> fireAndForgetFailed{0};
+};
+
+struct BatcherStats
+{
+	std::atomic<uint64_t> events{0};
+	std::atomic<uint64_t> eventsDropped{0};
+	std::atomic<uint64_t> batchesSent{0};
+	std::atomic<uint64_t> batchesFailed{0};
+};
+
+struct WebSocketStats
+{
+	std::atomic<uint64_t> messagesSent{0};
+	std::atomic<uint64_t> bytesSent{0};
+	std::atomic<uint64_t> bufferAllocations{0};
+	std::atomic<uint64_t> messagesReceived{0};
+	std::atomic<uint64_t> bytesReceived{0};
+	std::atomic<uint64_t> malformedMessages{0};
+	std::atomic<uint64_t> wireBytesSent{0};
+	std::atomic<uint64_t> wireBytesReceived{0};
+	std::atomic<uint64_t> reconnects{0};
+};
+
+/* Resources used by network threads, added up by the threads themselves */
+struct ThreadStats
+{
+	std::atomic<uint64_t> cpuTime{0};
+	std::atomic<uint64_t> contextSwitches{0};
+};
+
+/* Usage of a single thread when it was last recorded */
+struct ThreadSample
+{
+	uint64_t cpuTime = 0;
+	uint64_t contextSwitches = 0;
+	uint64_t excludedTime = 0;
+};
+
+/* How often network threads record their usage */
+#define SM_RIPEXT_THREAD_SAMPLE_INTERVAL 1000
+
+class RipExtStats
+{
+public:
+	void RecordTransfer(IHTTPContext *context, CURLcode result);
+	/* Adds the usage of the calling thread since the last sample, minus the growth of excludedTime,
+	 * a running total of time already counted elsewhere */
+	void RecordThread(ThreadStats &stats, ThreadSample &last, uint64_t excludedTime = 0);
+	void Print();
+
+public:
+	HTTPStats http;
+	BatcherStats batcher;
+	WebSocketStats websocket;
+	ThreadStats httpThread;
+	ThreadStats websocketThreads;
+	/* The HTTP loop runs on the first WebSocket thread, httpThread only counts the time spent in it */
+	bool unifiedLoop = false;
+};
+
+extern RipExtStats g_Stats;
+
+#endif // SM_RIPEXT_STATS_H_
@@ -0,0 +1,40 @@
+#include "websocket_buffer_pool.h"
+#include "stats.h"
+
+websocket_buffer_pool buffer_pool;
+
+std::string websocket_buffer_pool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        if (!this->buffers.empty())
+        {
+            std::string buffer = std::move(this->buffers.back());
+            this->buffers.pop_back();
+            return buffer;
+        }
+    }
+
+    g_Stats.websocket.bufferAllocations++;
+
+    std::string buffer;
+    buffer.reserve(WEBSOCKET_POOL_INITIAL_CAPACITY);
+    return buffer;
+}
+
+void websocket_buffer_pool::release(std::string &&buffer)
+{
+    // Keep the pool from pinning the memory of a few huge messages
+    if (buffer.capacity() > WEBSOCKET_POOL_MAX_CAPACITY)
+    {
+        return;
+    }
+
+    buffer.clear();
+
+    std::lock_guard<std::mutex> guard(this->mutex);
+    if (this->buffers.size() < WEBSOCKET_POOL_SIZE)
+    {
+        this->buffers.push_back(std::move(buffer));
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Number of idle buffers kept around, and the largest buffer worth keeping
+#define WEBSOCKET_POOL_SIZE 256
+#define WEBSOCKET_POOL_MAX_CAPACITY (64 * 1024)
+#define WEBSOCKET_POOL_INITIAL_CAPACITY 1024
+
+// Recycles the buffers of outgoing messages. Buffers are taken on the game
+// thread when a message is written, and given back by the connection's
+// strand once the write has completed.
+class websocket_buffer_pool
+{
+public:
+    std::string acquire();
+    void release(std::string &&buffer);
+
+private:
+    std::mutex mutex;
+    std::vector<std::string> buffers;
+};
+
+extern websocket_buffer_pool buffer_pool;
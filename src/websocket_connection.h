@@ -5,6 +5,7 @@
 #include <boost/asio.hpp>
 #include <memory>
 #include "websocket_connection_base.h"
+#include "websocket_stream.h"
 
 namespace websocket = boost::beast::websocket;
 namespace beast = boost::beast;
@@ -14,20 +15,24 @@ class websocket_connection : public websocket_connection_base
 {
 public:
     websocket_connection(std::string address, std::string endpoint, uint16_t port);
-    void connect();
-    void write(boost::asio::const_buffer buffer);
-    void close();
+
+protected:
+    void do_write(boost::asio::const_buffer buffer, bool binary);
+    void do_close();
+    void do_ping(const websocket::ping_data &payload);
+    void reset_stream();
+    void start_connect();
+    void cancel_connect();
 
 private:
-    void on_resolve(beast::error_code ec, tcp::resolver::results_type results);
-    void on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type ep);
-    void on_handshake(beast::error_code ec);
-    void on_write(beast::error_code ec, size_t bytes_transferred);
-    void on_read(beast::error_code ec, size_t bytes_transferred);
-    void on_close(beast::error_code ec);
-    bool socket_open();
+    void on_resolve(uint32_t generation, beast::error_code ec, tcp::resolver::results_type results);
+    void on_connect(uint32_t generation, beast::error_code ec, tcp::resolver::results_type::endpoint_type ep);
+    void on_handshake(uint32_t generation, beast::error_code ec);
+    void on_read(uint32_t generation, beast::error_code ec, size_t bytes_transferred);
+    void on_close(uint32_t generation, beast::error_code ec);
+    bool stream_open();
 
-    std::unique_ptr<websocket::stream<beast::tcp_stream>> ws;
+    std::unique_ptr<websocket::stream<websocket_tcp_stream>> ws;
     std::unique_ptr<boost::asio::io_context::work> work;
     std::shared_ptr<tcp::resolver> resolver;
 };
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "websocket_connection_base.h"
+#include "websocket_eventloop.h"
+#include "websocket_buffer_pool.h"
+#include "stats.h"
 
-websocket_connection_base::websocket_connection_base(std::string address, std::string endpoint, uint16_t port)
+websocket_connection_base::websocket_connection_base(std::string address, std::string endpoint, uint16_t port) : context(event_loop.get_context()), strand(boost::asio::make_strand(this->context)), reconnect_timer(this->strand), random(std::random_device()()), ping_timer(this->strand)
 {
     this->address = address;
     this->endpoint = endpoint;
@@ -12,9 +15,34 @@ void websocket_connection_base::set_write_callback(std::function<void(size_t)> c
     this->write_callback = std::make_unique<std::function<void(size_t)>>(callback);
 }
 
-void websocket_connection_base::set_read_callback(std::function<void(uint8_t *, size_t)> callback)
+void websocket_connection_base::set_read_callback(std::function<void(uint8_t *, size_t, bool)> callback)
 {
-    this->read_callback = std::make_unique<std::function<void(uint8_t *, size_t)>>(callback);
+    // Replaces the JSON callback, messages are only delivered once
+    boost::asio::post(this->strand, [this, callback = std::move(callback)]() mutable
+                      {
+        this->read_callback = std::make_unique<std::function<void(uint8_t *, size_t, bool)>>(std::move(callback));
+        this->json_callback.reset(); });
+}
+
+void websocket_connection_base::set_json_callback(std::function<void(json_t *)> callback)
+{
+    boost::asio::post(this->strand, [this, callback = std::move(callback)]() mutable
+                      {
+        this->json_callback = std::make_unique<std::function<void(json_t *)>>(std::move(callback));
+        this->read_callback.reset(); });
+}
+
+void websocket_connection_base::set_read_error_callback(std::function<void(std::string, std::string)> callback)
+{
+    boost::asio::post(this->strand, [this, callback = std::move(callback)]() mutable
+                      { this->read_error_callback = std::make_unique<std::function<void(std::string, std::string)>>(std::move(callback)); });
+}
+
+void websocket_connection_base::set_inbox(std::shared_ptr<websocket_inbox> inbox)
+{
+    // Read by on_message, which runs on the strand
+    boost::asio::post(this->strand, [this, inbox = std::move(inbox)]() mutable
+                      { this->inbox = std::move(inbox); });
 }
 
 void websocket_connection_base::set_connect_callback(std::function<void()> callback)
@@ -33,6 +61,18 @@ void websocket_connection_base::set_header(std::string header, std::string value
     this->headers.insert_or_assign(header, value);
 }
 
+void websocket_connection_base::set_compression(bool enable, int window_bits, int level, int mem_level)
+{
+    websocket::permessage_deflate deflate;
+    deflate.client_enable = enable;
+    deflate.client_max_window_bits = window_bits;
+    deflate.compLevel = level;
+    deflate.memLevel = mem_level;
+
+    boost::asio::post(this->strand, [this, deflate]()
+                      { this->deflate = deflate; });
+}
+
 void websocket_connection_base::add_headers(websocket::request_type &req)
 {
     req.set(beast::http::field::user_agent, std::string(BOOST_BEAST_VERSION_STRING) + " SourceMod-WebSockets v" + SMEXT_CONF_VERSION);
@@ -49,7 +89,512 @@ void websocket_connection_base::destroy()
     this->close();
 }
 
+void websocket_connection_base::close()
+{
+    boost::asio::post(this->strand, [this]()
+                      {
+        this->closing = true;
+        this->connect_pending = false;
+        this->ping_timer.cancel();
+
+        // Between attempts there is no stream to close, only the timer to stop
+        if (this->reconnect_waiting)
+        {
+            this->reconnect_timer.cancel();
+            return;
+        }
+
+        // The stream is not open yet, the handler of the current stage ends the attempt
+        if (this->connecting)
+        {
+            this->cancel_connect();
+            return;
+        }
+
+        this->do_close(); });
+}
+
+void websocket_connection_base::connect()
+{
+    boost::asio::post(this->strand, [this]()
+                      {
+        // Already connected or connecting, unless close() is still ending that
+        if ((this->ws_connect || this->connecting) && !this->closing)
+        {
+            return;
+        }
+
+        if (this->reconnect_waiting)
+        {
+            this->reconnect_timer.cancel();
+        }
+
+        // The stream is only replaced once nothing is using it anymore
+        this->connect_pending = true;
+        this->start_pending_connect(); });
+}
+
+void websocket_connection_base::start_pending_connect()
+{
+    if (!this->connect_pending || this->pending_delete || this->ws_connect || this->connecting || this->stream_busy())
+    {
+        return;
+    }
+
+    this->connect_pending = false;
+    this->closing = false;
+    this->reconnect_attempts = 0;
+    this->begin_connect();
+}
+
+void websocket_connection_base::begin_connect()
+{
+    this->connecting = true;
+    this->generation++;
+    this->reset_stream();
+    this->update_socket_open();
+    this->start_connect();
+}
+
+bool websocket_connection_base::stream_busy() const
+{
+    return this->writing || this->pinging || this->reading;
+}
+
+void websocket_connection_base::set_reconnect(bool enable, uint32_t min_delay, uint32_t max_delay)
+{
+    this->reconnect = enable;
+    this->reconnect_min_delay = min_delay;
+    this->reconnect_max_delay = max_delay;
+}
+
+void websocket_connection_base::set_timeouts(uint32_t handshake, uint32_t idle)
+{
+    this->handshake_timeout = handshake;
+    this->idle_timeout = idle;
+}
+
+void websocket_connection_base::set_ping_interval(uint32_t interval)
+{
+    this->ping_interval = interval;
+
+    boost::asio::post(this->strand, [this]()
+                      {
+        if (this->ws_connect && !this->ping_waiting)
+        {
+            this->schedule_ping();
+        } });
+}
+
+uint32_t websocket_connection_base::get_rtt()
+{
+    return this->rtt;
+}
+
+uint32_t websocket_connection_base::get_rtt_jitter()
+{
+    return this->rtt_jitter;
+}
+
+uint64_t websocket_connection_base::get_message_bytes_sent()
+{
+    return this->message_bytes_sent;
+}
+
+uint64_t websocket_connection_base::get_message_bytes_received()
+{
+    return this->message_bytes_received;
+}
+
+uint64_t websocket_connection_base::get_wire_bytes_sent()
+{
+    return this->wire_bytes.sent;
+}
+
+uint64_t websocket_connection_base::get_wire_bytes_received()
+{
+    return this->wire_bytes.received;
+}
+
+void websocket_connection_base::set_connect_deadline(websocket_tcp_stream &stream)
+{
+    uint32_t timeout = this->handshake_timeout;
+    if (timeout > 0)
+    {
+        stream.expires_after(std::chrono::milliseconds(timeout));
+    }
+    else
+    {
+        stream.expires_never();
+    }
+}
+
+void websocket_connection_base::schedule_ping()
+{
+    uint32_t interval = this->ping_interval;
+    if (interval == 0 || this->closing)
+    {
+        return;
+    }
+
+    this->ping_waiting = true;
+    this->ping_timer.expires_after(std::chrono::milliseconds(interval));
+    this->ping_timer.async_wait(beast::bind_front_handler(&websocket_connection_base::on_ping_timer, this));
+}
+
+void websocket_connection_base::on_ping_timer(beast::error_code ec)
+{
+    this->ping_waiting = false;
+
+    // Only once the read loop has ended, until then it deletes the connection
+    if (this->delete_after_write)
+    {
+        this->delete_when_idle();
+        return;
+    }
+
+    if (ec || !this->ws_connect)
+    {
+        return;
+    }
+
+    // An unanswered ping is replaced, a late pong for it no longer matches the payload
+    if (!this->pinging)
+    {
+        this->pinging = true;
+        this->awaiting_pong = true;
+        this->ping_sent = std::chrono::steady_clock::now();
+        this->ping_payload = std::to_string(this->ping_sent.time_since_epoch().count());
+        this->do_ping(websocket::ping_data(this->ping_payload.c_str()));
+    }
+
+    this->schedule_ping();
+}
+
+void websocket_connection_base::on_ping(beast::error_code ec)
+{
+    this->pinging = false;
+
+    if (ec)
+    {
+        this->awaiting_pong = false;
+    }
+
+    if (this->delete_after_write)
+    {
+        this->delete_when_idle();
+        return;
+    }
+
+    this->start_pending_connect();
+}
+
+void websocket_connection_base::on_pong(beast::string_view payload)
+{
+    // Pongs for the keep alive pings of beast have no payload
+    if (!this->awaiting_pong || payload != this->ping_payload)
+    {
+        return;
+    }
+    this->awaiting_pong = false;
+
+    int64_t sample = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->ping_sent).count();
+
+    // Smoothed like TCP retransmission timers, see RFC 6298
+    if (!this->rtt_measured)
+    {
+        this->rtt_measured = true;
+        this->rtt = (uint32_t)sample;
+        this->rtt_jitter = (uint32_t)(sample / 2);
+        return;
+    }
+
+    int64_t srtt = this->rtt;
+    int64_t rttvar = this->rtt_jitter;
+    rttvar = (3 * rttvar + std::abs(srtt - sample)) / 4;
+    srtt = (7 * srtt + sample) / 8;
+
+    this->rtt = (uint32_t)srtt;
+    this->rtt_jitter = (uint32_t)rttvar;
+}
+
+void websocket_connection_base::on_open()
+{
+    this->connecting = false;
+    this->reconnect_attempts = 0;
+    this->ws_connect = true;
+    this->update_socket_open();
+    this->schedule_ping();
+
+    if (this->connect_callback)
+    {
+        this->connect_callback->operator()();
+    }
+
+    // Messages queued while the connection was down go out first
+    this->write_next();
+}
+
+bool websocket_connection_base::connect_cancelled(uint32_t generation)
+{
+    if (this->stale(generation))
+    {
+        return true;
+    }
+
+    if (!this->closing)
+    {
+        return false;
+    }
+
+    this->on_disconnect();
+    return true;
+}
+
+void websocket_connection_base::on_disconnect()
+{
+    this->connecting = false;
+    this->ws_connect = false;
+    this->update_socket_open();
+    this->awaiting_pong = false;
+    this->ping_timer.cancel();
+
+    // The handle is gone, so no callback. Until close() has run it still refers to the connection,
+    // after that nothing else will delete it.
+    if (this->pending_delete)
+    {
+        if (this->closing)
+        {
+            this->delete_when_idle();
+        }
+        return;
+    }
+
+    if (this->disconnect_callback)
+    {
+        this->disconnect_callback->operator()();
+    }
+
+    if (!this->reconnect || this->closing)
+    {
+        this->start_pending_connect();
+        return;
+    }
+
+    // Exponential backoff with jitter, so connections that dropped together do not return together
+    uint64_t delay = std::min<uint64_t>((uint64_t)this->reconnect_min_delay << std::min(this->reconnect_attempts, 16u), this->reconnect_max_delay);
+    delay = delay / 2 + this->random() % (delay / 2 + 1);
+
+    this->reconnect_attempts++;
+    this->schedule_reconnect((uint32_t)delay);
+}
+
+void websocket_connection_base::schedule_reconnect(uint32_t delay)
+{
+    this->reconnect_waiting = true;
+    this->reconnect_timer.expires_after(std::chrono::milliseconds(delay));
+    this->reconnect_timer.async_wait(beast::bind_front_handler(&websocket_connection_base::on_reconnect_timer, this));
+}
+
+void websocket_connection_base::on_reconnect_timer(beast::error_code ec)
+{
+    this->reconnect_waiting = false;
+
+    if (this->pending_delete)
+    {
+        this->delete_when_idle();
+        return;
+    }
+
+    if (ec || this->closing || this->connecting)
+    {
+        return;
+    }
+
+    // A write or ping that failed with the old stream has not completed yet
+    if (this->stream_busy())
+    {
+        this->schedule_reconnect(100);
+        return;
+    }
+
+    g_Stats.websocket.reconnects++;
+    g_RipExt.LogDebug("Reconnecting to %s:%d (attempt %u)", this->address.c_str(), this->port, this->reconnect_attempts);
+
+    this->begin_connect();
+}
+
+bool websocket_connection_base::write(std::string message, bool binary)
+{
+    // Once over the high water mark, writes are refused until the queue drains below the low water mark
+    size_t high = this->high_water_mark;
+    if (this->congested || (high > 0 && this->queued_bytes + message.size() > high))
+    {
+        this->congested = true;
+        buffer_pool.release(std::move(message));
+        return false;
+    }
+
+    this->queued_bytes += message.size();
+
+    // The queue owns a copy, so the plugin's memory can go away before the write runs
+    boost::asio::post(this->strand, [this, message = std::move(message), binary]() mutable
+                      {
+        this->send_queue.push_back({std::move(message), binary});
+        this->write_next(); });
+
+    return true;
+}
+
+void websocket_connection_base::set_water_marks(size_t high, size_t low)
+{
+    this->high_water_mark = high;
+    this->low_water_mark = low;
+}
+
+size_t websocket_connection_base::get_queued_bytes()
+{
+    return this->queued_bytes;
+}
+
+void websocket_connection_base::write_next()
+{
+    // Beast allows a single outstanding write, messages written before the handshake wait for it
+    if (this->writing || this->send_queue.empty() || !this->ws_connect)
+    {
+        return;
+    }
+
+    this->writing = true;
+    const websocket_message &message = this->send_queue.front();
+    this->do_write(boost::asio::buffer(message.data), message.binary);
+}
+
+void websocket_connection_base::on_write(beast::error_code ec, std::size_t bytes_transferred)
+{
+    this->writing = false;
+
+    if (this->delete_after_write)
+    {
+        this->delete_when_idle();
+        return;
+    }
+
+    if (ec)
+    {
+        g_RipExt.LogError("WebSocket write error: %d %s", ec.value(), ec.message().c_str());
+
+        // Kept for the next connection, including the message that failed
+        if (!this->reconnect || this->closing || this->pending_delete)
+        {
+            // The connection is gone, so is everything that was queued for it
+            for (websocket_message &message : this->send_queue)
+            {
+                buffer_pool.release(std::move(message.data));
+            }
+            this->send_queue.clear();
+            this->queued_bytes = 0;
+            this->congested = false;
+        }
+
+        this->start_pending_connect();
+        return;
+    }
+
+    g_Stats.websocket.messagesSent++;
+    g_Stats.websocket.bytesSent += bytes_transferred;
+    this->message_bytes_sent += bytes_transferred;
+
+    this->queued_bytes -= this->send_queue.front().data.size();
+    buffer_pool.release(std::move(this->send_queue.front().data));
+    this->send_queue.pop_front();
+
+    if (this->congested && this->queued_bytes <= this->low_water_mark)
+    {
+        this->congested = false;
+    }
+
+    this->write_next();
+    this->start_pending_connect();
+}
+
+void websocket_connection_base::on_message(size_t size, bool binary)
+{
+    const char *message = reinterpret_cast<const char *>(this->buffer.data().data());
+
+    g_Stats.websocket.messagesReceived++;
+    g_Stats.websocket.bytesReceived += size;
+    this->message_bytes_received += size;
+
+    // Batched messages are copied once, into the buffer of the current frame
+    if (this->inbox)
+    {
+        this->inbox->push(message, size, binary);
+        return;
+    }
+
+    // Parsed here rather than on the game thread, which only has to create the handle
+    if (this->json_callback)
+    {
+        json_error_t error;
+        json_t *object = json_loadb(message, size, 0, &error);
+        if (object == nullptr)
+        {
+            g_Stats.websocket.malformedMessages++;
+            if (this->read_error_callback)
+            {
+                this->read_error_callback->operator()(error.text, std::string(message, size));
+            }
+            return;
+        }
+
+        this->json_callback->operator()(object);
+        return;
+    }
+
+    if (this->read_callback)
+    {
+        // Null terminated, so the game thread can hand it to plugins without another copy
+        auto buffer = reinterpret_cast<uint8_t *>(malloc(size + 1));
+        memcpy(buffer, message, size);
+        buffer[size] = '\0';
+
+        this->read_callback->operator()(buffer, size, binary);
+    }
+}
+
+void websocket_connection_base::delete_when_idle()
+{
+    if (this->has_pending_operations())
+    {
+        this->delete_after_write = true;
+        return;
+    }
+
+    delete this;
+}
+
+bool websocket_connection_base::has_pending_operations() const
+{
+    return this->writing || this->reading || this->closes_pending > 0 || this->connecting || this->reconnect_waiting || this->ping_waiting || this->pinging;
+}
+
+bool websocket_connection_base::stale(uint32_t generation) const
+{
+    return generation != this->generation;
+}
+
 bool websocket_connection_base::ws_open()
 {
     return this->ws_connect;
+}
+
+bool websocket_connection_base::socket_open()
+{
+    return this->tcp_open;
+}
+
+void websocket_connection_base::update_socket_open()
+{
+    this->tcp_open = this->stream_open();
 }
\ No newline at end of file
@@ -5,7 +5,12 @@
 #include <boost/asio.hpp>
 #include <memory>
 #include "extension.h"
+#include "websocket_inbox.h"
+#include "websocket_stream.h"
+#include <atomic>
+#include <deque>
 #include <map>
+#include <random>
 
 #if defined WIN32
 #include <sdkddkver.h>
@@ -15,35 +20,217 @@ namespace websocket = boost::beast::websocket;
 namespace beast = boost::beast;
 using tcp = boost::asio::ip::tcp;
 
+// Default limits of the send queue, see set_water_marks
+#define WEBSOCKET_DEFAULT_HIGH_WATER_MARK (8 * 1024 * 1024)
+#define WEBSOCKET_DEFAULT_LOW_WATER_MARK (2 * 1024 * 1024)
+
+// Default delays in milliseconds between reconnect attempts, see set_reconnect
+#define WEBSOCKET_DEFAULT_RECONNECT_MIN_DELAY 1000
+#define WEBSOCKET_DEFAULT_RECONNECT_MAX_DELAY 30000
+
+// Default time in milliseconds to connect, including TLS and the WebSocket handshake
+#define WEBSOCKET_DEFAULT_HANDSHAKE_TIMEOUT 30000
+
+// A queued message, sent as a binary frame instead of a text frame if binary is set
+struct websocket_message
+{
+    std::string data;
+    bool binary;
+};
+
 class websocket_connection_base
 {
 public:
     websocket_connection_base(std::string address, std::string endpoint, uint16_t port);
+    virtual ~websocket_connection_base() = default;
     void set_write_callback(std::function<void(std::size_t)> callback);
-    void set_read_callback(std::function<void(uint8_t *, std::size_t)> callback);
+    // Called with the message, its size and whether it was a binary frame
+    void set_read_callback(std::function<void(uint8_t *, std::size_t, bool)> callback);
+    // Messages are parsed on the network thread, the callback takes ownership of the JSON
+    void set_json_callback(std::function<void(json_t *)> callback);
+    // Called with the parse error and the message when a message is not valid JSON
+    void set_read_error_callback(std::function<void(std::string, std::string)> callback);
+    // Delivers incoming messages in one batch per frame instead of the read callback
+    void set_inbox(std::shared_ptr<websocket_inbox> inbox);
     void set_connect_callback(std::function<void()> callback);
     void set_disconnect_callback(std::function<void()> callback);
     void set_header(std::string key, std::string value);
+    // Offers permessage-deflate in the next handshake, the server decides whether it is used
+    void set_compression(bool enable, int window_bits, int level, int mem_level);
     void add_headers(websocket::request_type &req);
     void destroy();
     bool ws_open();
 
-    virtual void close() = 0;
-    virtual void connect() = 0;
-    virtual void write(boost::asio::const_buffer buffer) = 0;
-    virtual bool socket_open() = 0;
+    // Queues a message, returns false if the queue is over the high water mark
+    bool write(std::string message, bool binary = false);
+    void set_water_marks(size_t high, size_t low);
+    size_t get_queued_bytes();
+
+    void close();
+    // Connects, or connects again after the connection failed or was closed
+    void connect();
+    // Once the connection fails it is opened again, waiting twice as long after every
+    // failed attempt. Messages queued in the meantime are sent after the handshake.
+    void set_reconnect(bool enable, uint32_t min_delay, uint32_t max_delay);
+    // Applied to the next connection, a timeout of 0 never expires
+    void set_timeouts(uint32_t handshake, uint32_t idle);
+    // Pings an open connection every interval milliseconds to measure the round-trip time, 0 to stop
+    void set_ping_interval(uint32_t interval);
+    // Smoothed round-trip time and its mean deviation in microseconds, as in RFC 6298
+    uint32_t get_rtt();
+    uint32_t get_rtt_jitter();
+    // Message payloads of this connection, before permessage-deflate
+    uint64_t get_message_bytes_sent();
+    uint64_t get_message_bytes_received();
+    // What went over the socket of this connection, after permessage-deflate and TLS
+    uint64_t get_wire_bytes_sent();
+    uint64_t get_wire_bytes_received();
+    // Safe to call from any thread, the stream itself is only touched on the strand
+    bool socket_open();
 
 protected:
-    std::unique_ptr<std::function<void(uint8_t *, std::size_t)>> read_callback;
+    // Called on the strand
+    virtual void do_write(boost::asio::const_buffer buffer, bool binary) = 0;
+    virtual void do_close() = 0;
+    // Replaces the stream, a beast stream cannot be connected again
+    virtual void reset_stream() = 0;
+    virtual void start_connect() = 0;
+    // Aborts the resolve, connect or handshake that is running, its handler still runs
+    virtual void cancel_connect() = 0;
+    // Whether the TCP socket of the current stream is open
+    virtual bool stream_open() = 0;
+    // Called whenever the stream may have been opened, closed or replaced
+    void update_socket_open();
+    // Called first by every connect stage, ends the attempt if close() ran in the meantime
+    bool connect_cancelled(uint32_t generation);
+    // Whether a handler belongs to a stream that has been replaced since
+    bool stale(uint32_t generation) const;
+    // Replaces the stream and starts a new attempt
+    void begin_connect();
+    // Starts a connect() that had to wait for the old stream, once nothing uses it anymore
+    void start_pending_connect();
+    // Operations on the current stream other than connecting
+    bool stream_busy() const;
+    // Called once the handshake completed and the read loop has started
+    void on_open();
+    // Called when an attempt to connect fails or an open connection is lost
+    void on_disconnect();
+    void schedule_reconnect(uint32_t delay);
+    void on_reconnect_timer(beast::error_code ec);
+    virtual void do_ping(const websocket::ping_data &payload) = 0;
+    void schedule_ping();
+    void on_ping_timer(beast::error_code ec);
+    void on_ping(beast::error_code ec);
+    void on_pong(beast::string_view payload);
+    // Operations other than the read loop that still refer to the connection
+    bool has_pending_operations() const;
+    void set_connect_deadline(websocket_tcp_stream &stream);
+
+    // Sets everything the handshake needs on a new stream
+    template <class Stream>
+    void apply_options(websocket::stream<Stream> &ws)
+    {
+        websocket::stream_base::timeout timeout = websocket::stream_base::timeout::suggested(beast::role_type::client);
+        uint32_t handshake = this->handshake_timeout;
+        uint32_t idle = this->idle_timeout;
+        timeout.handshake_timeout = handshake > 0 ? std::chrono::milliseconds(handshake) : websocket::stream_base::none();
+        timeout.idle_timeout = idle > 0 ? std::chrono::milliseconds(idle) : websocket::stream_base::none();
+        // Pings a quiet connection halfway through the idle timeout before giving up on it
+        timeout.keep_alive_pings = true;
+        ws.set_option(timeout);
+
+        // All the callbacks in this class use `this` as a pointer instead of the smart pointer.
+        // That's because this class spends most of it's life managed by SourceMod
+        ws.set_option(websocket::stream_base::decorator([this](websocket::request_type &req)
+                                                        { this->add_headers(req); }));
+        ws.set_option(this->deflate);
+        ws.control_callback([this](websocket::frame_type kind, beast::string_view payload)
+                            {
+            if (kind == websocket::frame_type::pong)
+            {
+                this->on_pong(payload);
+            } });
+    }
+    void on_write(beast::error_code ec, std::size_t bytes_transferred);
+    void write_next();
+    // Hands the message at the front of the read buffer to the plugin
+    void on_message(size_t size, bool binary);
+    void delete_when_idle();
+
+    // The context of the thread this connection runs on, picked once when it is created
+    boost::asio::io_context &context;
+    boost::asio::strand<boost::asio::io_context::executor_type> strand;
+
+    // Owned by the strand, only the front message is being written
+    std::deque<websocket_message> send_queue;
+    bool writing = false;
+    // Set when the connection is deleted while other operations are pending, see has_pending_operations
+    bool delete_after_write = false;
+
+    // Owned by the strand
+    boost::asio::steady_timer reconnect_timer;
+    bool reconnect_waiting = false;
+    bool connecting = false;
+    bool closing = false;
+    bool reading = false;
+    // Closes still running, possibly on a stream that has been replaced since
+    uint32_t closes_pending = 0;
+    // Set by connect() while the old stream is still closing
+    bool connect_pending = false;
+    // Incremented for every new stream, handlers are bound to the one they were started on
+    uint32_t generation = 0;
+    uint32_t reconnect_attempts = 0;
+    std::minstd_rand random;
+    // Reused by reconnects until connecting to them fails
+    tcp::resolver::results_type endpoints;
+
+    std::atomic<bool> reconnect{false};
+    std::atomic<uint32_t> reconnect_min_delay{WEBSOCKET_DEFAULT_RECONNECT_MIN_DELAY};
+    std::atomic<uint32_t> reconnect_max_delay{WEBSOCKET_DEFAULT_RECONNECT_MAX_DELAY};
+
+    // Owned by the strand
+    boost::asio::steady_timer ping_timer;
+    bool ping_waiting = false;
+    bool pinging = false;
+    bool awaiting_pong = false;
+    std::string ping_payload;
+    std::chrono::steady_clock::time_point ping_sent;
+    bool rtt_measured = false;
+
+    std::atomic<uint32_t> handshake_timeout{WEBSOCKET_DEFAULT_HANDSHAKE_TIMEOUT};
+    std::atomic<uint32_t> idle_timeout{0};
+    std::atomic<uint32_t> ping_interval{0};
+    std::atomic<uint32_t> rtt{0};
+    std::atomic<uint32_t> rtt_jitter{0};
+
+    // Updated on the strand, the wire bytes by the rate policy of every new stream
+    std::atomic<uint64_t> message_bytes_sent{0};
+    std::atomic<uint64_t> message_bytes_received{0};
+    websocket_wire_bytes wire_bytes;
+
+    std::atomic<size_t> queued_bytes{0};
+    std::atomic<size_t> high_water_mark{WEBSOCKET_DEFAULT_HIGH_WATER_MARK};
+    std::atomic<size_t> low_water_mark{WEBSOCKET_DEFAULT_LOW_WATER_MARK};
+    std::atomic<bool> congested{false};
+
+    // Owned by the strand
+    std::unique_ptr<std::function<void(uint8_t *, std::size_t, bool)>> read_callback;
+    std::unique_ptr<std::function<void(json_t *)>> json_callback;
+    std::unique_ptr<std::function<void(std::string, std::string)>> read_error_callback;
+    std::shared_ptr<websocket_inbox> inbox;
     std::unique_ptr<std::function<void(std::size_t)>> write_callback;
     std::unique_ptr<std::function<void()>> connect_callback;
     std::unique_ptr<std::function<void()>> disconnect_callback;
+    // Owned by the strand, applied before the handshake
+    websocket::permessage_deflate deflate;
     std::map<std::string, std::string> headers;
     std::mutex header_mutex;
     beast::flat_buffer buffer;
     std::string address;
     std::string endpoint;
     uint16_t port;
-    bool pending_delete = false;
-    bool ws_connect = false;
+    std::atomic<bool> pending_delete{false};
+    std::atomic<bool> ws_connect{false};
+    // Written on the strand by update_socket_open
+    std::atomic<bool> tcp_open{false};
 };
\ No newline at end of file
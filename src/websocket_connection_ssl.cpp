@@ -4,185 +4,210 @@
 
 websocket_connection_ssl::websocket_connection_ssl(std::string address, std::string endpoint, uint16_t port) : websocket_connection_base(address, endpoint, port)
 {
-    this->ws = std::make_unique<websocket::stream<beast::ssl_stream<beast::tcp_stream>>>(boost::asio::make_strand(event_loop.get_context()), event_loop.get_ssl_context());
-    this->work = std::make_unique<boost::asio::io_context::work>(event_loop.get_context());
-    this->resolver = std::make_shared<tcp::resolver>(event_loop.get_context());
+    this->ws = std::make_unique<websocket::stream<beast::ssl_stream<websocket_tcp_stream>>>(this->strand, event_loop.get_ssl_context());
+    this->work = std::make_unique<boost::asio::io_context::work>(this->context);
+    this->resolver = std::make_shared<tcp::resolver>(this->strand);
 }
 
-void websocket_connection_ssl::connect()
+void websocket_connection_ssl::reset_stream()
 {
+    this->ws = std::make_unique<websocket::stream<beast::ssl_stream<websocket_tcp_stream>>>(this->strand, event_loop.get_ssl_context());
+    beast::get_lowest_layer(*this->ws).rate_policy().set_connection(&this->wire_bytes);
+    this->buffer.clear();
+}
+
+void websocket_connection_ssl::start_connect()
+{
+    // Addresses that worked before are reused, they are resolved again once connecting to them fails
+    if (!this->endpoints.empty())
+    {
+        this->on_resolve(this->generation, {}, this->endpoints);
+        return;
+    }
+
     char s_port[8];
     std::snprintf(s_port, sizeof(s_port), "%hu", this->port);
     tcp::resolver::query query(this->address.c_str(), s_port);
 
-    this->resolver->async_resolve(query, beast::bind_front_handler(&websocket_connection_ssl::on_resolve, this));
-    g_RipExt.LogMessage("Init Connect %s:%d", address.c_str(), this->port);
+    this->resolver->async_resolve(query, beast::bind_front_handler(&websocket_connection_ssl::on_resolve, this, this->generation));
+    g_RipExt.LogDebug("Init Connect %s:%d", address.c_str(), this->port);
 }
 
-void websocket_connection_ssl::on_resolve(beast::error_code ec, tcp::resolver::results_type results)
+void websocket_connection_ssl::on_resolve(uint32_t generation, beast::error_code ec, tcp::resolver::results_type results)
 {
+    if (this->connect_cancelled(generation))
+    {
+        return;
+    }
+
     if (ec)
     {
         g_RipExt.LogError("Error resolving %s: %d %s", this->address.c_str(), ec.value(), ec.message().c_str());
-        if (this->disconnect_callback)
-        {
-            this->disconnect_callback->operator()();
-        }
-        this->ws_connect = false;
+        this->on_disconnect();
         return;
     }
 
-    beast::get_lowest_layer(*this->ws).expires_after(std::chrono::seconds(30));
-    beast::get_lowest_layer(*this->ws).async_connect(results, beast::bind_front_handler(&websocket_connection_ssl::on_connect, this));
+    this->endpoints = results;
+    this->set_connect_deadline(beast::get_lowest_layer(*this->ws));
+    beast::get_lowest_layer(*this->ws).async_connect(results, beast::bind_front_handler(&websocket_connection_ssl::on_connect, this, this->generation));
 }
 
-void websocket_connection_ssl::on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type ep)
+void websocket_connection_ssl::on_connect(uint32_t generation, beast::error_code ec, tcp::resolver::results_type::endpoint_type ep)
 {
+    if (this->connect_cancelled(generation))
+    {
+        return;
+    }
+
     if (ec)
     {
         g_RipExt.LogError("Error connecting to %s: %d %s", this->address.c_str(), ec.value(), ec.message().c_str());
-        if (this->disconnect_callback)
-        {
-            this->disconnect_callback->operator()();
-        }
-        this->ws_connect = false;
+        this->endpoints = {};
+        this->on_disconnect();
         return;
     }
+    this->update_socket_open();
 
     auto host = this->address + ":" + std::to_string(this->port);
-    beast::get_lowest_layer(*this->ws).expires_after(std::chrono::seconds(30));
+    this->set_connect_deadline(beast::get_lowest_layer(*this->ws));
     if (!SSL_set_tlsext_host_name(this->ws->next_layer().native_handle(), host.c_str()))
     {
         ec = beast::error_code(static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category());
         g_RipExt.LogError("SSL Error: %d %s", ec.value(), ec.message().c_str());
-        if (this->disconnect_callback)
-        {
-            this->disconnect_callback->operator()();
-        }
-        this->ws_connect = false;
+        this->on_disconnect();
+        return;
     }
 
     this->ws->next_layer().async_handshake(
         boost::asio::ssl::stream_base::client,
         beast::bind_front_handler(
             &websocket_connection_ssl::on_ssl_handshake,
-            this));
+            this, this->generation));
 }
 
-void websocket_connection_ssl::on_ssl_handshake(beast::error_code ec)
+void websocket_connection_ssl::on_ssl_handshake(uint32_t generation, beast::error_code ec)
 {
+    if (this->connect_cancelled(generation))
+    {
+        return;
+    }
+
     if (ec)
     {
         g_RipExt.LogError("SSL Handshake Error: %d %s", ec.value(), ec.message().c_str());
-        if (this->disconnect_callback)
-        {
-            this->disconnect_callback->operator()();
-        }
-        this->ws_connect = false;
+        this->on_disconnect();
         return;
     }
     beast::get_lowest_layer(*this->ws).expires_never();
 
-    auto timeout = websocket::stream_base::timeout::suggested(beast::role_type::client);
-    timeout.keep_alive_pings = true;
-    this->ws->set_option(timeout);
-    // All the callbacks in this class use `this` as a pointer instead of the smart pointer.
-    // That's because this class spends most of it's life managed by SourceMod
-    this->ws->set_option(websocket::stream_base::decorator([this](websocket::request_type &req)
-                                                           { this->add_headers(req); }));
+    this->apply_options(*this->ws);
 
-    this->ws->async_handshake(this->address, this->endpoint.c_str(), beast::bind_front_handler(&websocket_connection_ssl::on_handshake, this));
+    this->ws->async_handshake(this->address, this->endpoint.c_str(), beast::bind_front_handler(&websocket_connection_ssl::on_handshake, this, this->generation));
 }
 
-void websocket_connection_ssl::on_handshake(beast::error_code ec)
+void websocket_connection_ssl::on_handshake(uint32_t generation, beast::error_code ec)
 {
-    if (ec)
+    if (this->connect_cancelled(generation))
     {
-        g_RipExt.LogError("WebSocket Handshake Error: %s", ec.message().c_str());
-        if (this->disconnect_callback)
-        {
-            this->disconnect_callback->operator()();
-        }
-        this->ws_connect = false;
         return;
     }
 
-    this->buffer.clear();
-    if (this->connect_callback)
+    if (ec)
     {
-        this->connect_callback->operator()();
+        g_RipExt.LogError("WebSocket Handshake Error: %s", ec.message().c_str());
+        this->on_disconnect();
+        return;
     }
 
-    this->ws->async_read(this->buffer, beast::bind_front_handler(&websocket_connection_ssl::on_read, this));
-    this->ws_connect = true;
-    g_RipExt.LogMessage("On Handshaked %s:%d", address.c_str(), this->port);
+    this->buffer.clear();
+    this->reading = true;
+    this->ws->async_read(this->buffer, beast::bind_front_handler(&websocket_connection_ssl::on_read, this, this->generation));
+    this->on_open();
+    g_RipExt.LogDebug("On Handshaked %s:%d", address.c_str(), this->port);
 }
 
-void websocket_connection_ssl::on_write(beast::error_code ec, size_t bytes_transferred)
+void websocket_connection_ssl::on_read(uint32_t generation, beast::error_code ec, size_t bytes_transferred)
 {
-    if (ec)
+    if (this->stale(generation))
     {
-        g_RipExt.LogError("WebSocket write error: %s", ec.message().c_str());
         return;
     }
-}
 
-void websocket_connection_ssl::on_read(beast::error_code ec, size_t bytes_transferred)
-{
     if (ec)
     {
+        this->reading = false;
         if (this->pending_delete)
         {
-            delete this;
+            this->delete_when_idle();
         }
         else
         {
             g_RipExt.LogError("WebSocket read error: %d %s", ec.value(), ec.message().c_str());
-            if (this->disconnect_callback)
-            {
-                this->disconnect_callback->operator()();
-            }
-            this->ws_connect = false;
+            this->on_disconnect();
         }
         return;
     }
 
-    if (this->read_callback)
-    {
-        auto buffer = reinterpret_cast<uint8_t *>(malloc(bytes_transferred));
-        memcpy(buffer, reinterpret_cast<const uint8_t *>(this->buffer.data().data()), bytes_transferred);
-
-        this->read_callback->operator()(buffer, bytes_transferred);
-    }
+    this->on_message(bytes_transferred, this->ws->got_binary());
     this->buffer.consume(bytes_transferred);
 
-    this->ws->async_read(this->buffer, beast::bind_front_handler(&websocket_connection_ssl::on_read, this));
+    this->ws->async_read(this->buffer, beast::bind_front_handler(&websocket_connection_ssl::on_read, this, this->generation));
 }
 
-void websocket_connection_ssl::on_close(beast::error_code ec)
+void websocket_connection_ssl::on_close(uint32_t generation, beast::error_code ec)
 {
+    this->closes_pending--;
+    if (this->delete_after_write)
+    {
+        this->delete_when_idle();
+        return;
+    }
+
+    // The stream was already replaced after the read loop ended
+    if (this->stale(generation))
+    {
+        return;
+    }
+
     if (ec)
     {
         g_RipExt.LogError("WebSocket close error: %s", ec.message().c_str());
         if (this->pending_delete)
         {
-            delete this;
+            this->delete_when_idle();
+            return;
         }
     }
     this->ws_connect = false;
+    this->update_socket_open();
+    this->start_pending_connect();
 }
 
-void websocket_connection_ssl::write(boost::asio::const_buffer buffer)
+void websocket_connection_ssl::do_write(boost::asio::const_buffer buffer, bool binary)
 {
+    // Only one write is in flight, so the opcode can be changed for every message
+    this->ws->binary(binary);
     this->ws->async_write(buffer, beast::bind_front_handler(&websocket_connection_ssl::on_write, this));
 }
 
-void websocket_connection_ssl::close()
+void websocket_connection_ssl::do_ping(const websocket::ping_data &payload)
+{
+    this->ws->async_ping(payload, beast::bind_front_handler(&websocket_connection_ssl::on_ping, this));
+}
+
+void websocket_connection_ssl::cancel_connect()
+{
+    this->resolver->cancel();
+    beast::get_lowest_layer(*this->ws).cancel();
+}
+
+void websocket_connection_ssl::do_close()
 {
-    this->ws->async_close(websocket::close_code::normal, beast::bind_front_handler(&websocket_connection_ssl::on_close, this));
+    this->closes_pending++;
+    this->ws->async_close(websocket::close_code::normal, beast::bind_front_handler(&websocket_connection_ssl::on_close, this, this->generation));
 }
 
-bool websocket_connection_ssl::socket_open()
+bool websocket_connection_ssl::stream_open()
 {
     return this->ws->is_open();
 }
\ No newline at end of file
@@ -1,33 +1,177 @@
 #include "websocket_eventloop.h"
+#include "stats.h"
+#include "config.h"
+#include <future>
 #include <thread>
 
-websocket_eventloop event_loop;
+#if defined __linux__
+#include <poll.h>
+#endif
 
-void ev_run()
-{
-    event_loop.run();
-}
+websocket_eventloop event_loop;
 
 void websocket_eventloop::OnExtLoad()
 {
-    std::thread(ev_run).detach();
+    size_t count = std::min(std::max(g_Config.GetWebSocketThreads(), 1L), (long)WEBSOCKET_MAX_THREADS);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Only this context's thread runs it
+        this->contexts.push_back(std::make_unique<boost::asio::io_context>(1));
+        this->work.push_back(boost::asio::make_work_guard(*this->contexts.back()));
+    }
+
+    for (auto &context : this->contexts)
+    {
+        this->threads.emplace_back([this, &context = *context]()
+                                   { this->run(context); });
+    }
 }
 
 void websocket_eventloop::OnExtUnload()
 {
-    this->context.stop();
-    this->context.reset();
+    this->work.clear();
+
+    for (auto &context : this->contexts)
+    {
+        context->stop();
+    }
+
+    // The contexts outlive their threads, connections that were not closed yet still refer to them
+    for (std::thread &thread : this->threads)
+    {
+        thread.join();
+    }
+    this->threads.clear();
 }
 
-void websocket_eventloop::run()
+void websocket_eventloop::run(boost::asio::io_context &context)
 {
-    this->context.run();
+    // Everything the connections on this context do runs here, TLS and compression included
+    boost::asio::steady_timer timer(context);
+    bool hosts_uv_loop = &context == this->contexts.front().get();
+    ThreadSample last;
+    std::function<void(boost::system::error_code)> sample = [&](boost::system::error_code ec)
+    {
+        if (ec)
+        {
+            return;
+        }
+
+        g_Stats.RecordThread(g_Stats.websocketThreads, last, hosts_uv_loop ? this->uv_run_time : 0);
+
+        timer.expires_after(std::chrono::milliseconds(SM_RIPEXT_THREAD_SAMPLE_INTERVAL));
+        timer.async_wait(sample);
+    };
+    sample({});
+
+    context.run();
 }
 
 boost::asio::io_context &websocket_eventloop::get_context()
 {
-    return this->context;
+    return *this->contexts[this->next_context++ % this->contexts.size()];
+}
+
+#if defined __linux__
+bool websocket_eventloop::attach_uv_loop(uv_loop_t *loop)
+{
+    boost::asio::io_context &context = *this->contexts.front();
+
+    // The backend fd is an epoll fd, which becomes readable whenever libuv has events
+    this->uv_fd = std::make_unique<boost::asio::posix::stream_descriptor>(context, uv_backend_fd(loop));
+    this->uv_timer = std::make_unique<boost::asio::steady_timer>(context);
+
+    boost::asio::post(context, [this, loop]()
+                      {
+        this->uv_loop = loop;
+        this->poll_uv_loop(); });
+
+    return true;
+}
+
+void websocket_eventloop::detach_uv_loop()
+{
+    std::promise<void> detached;
+
+    boost::asio::post(*this->contexts.front(), [this, &detached]()
+                      {
+        this->uv_loop = nullptr;
+        this->uv_timer->cancel();
+
+        // The fd belongs to libuv, it must not be closed here
+        this->uv_fd->release();
+        detached.set_value(); });
+
+    detached.get_future().wait();
+}
+
+void websocket_eventloop::poll_uv_loop()
+{
+    if (this->uv_loop == nullptr)
+    {
+        return;
+    }
+
+    // Never blocks, so the time spent in it is close to the CPU time of the HTTP loop
+    auto start = std::chrono::steady_clock::now();
+    uv_run(this->uv_loop, UV_RUN_NOWAIT);
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    g_Stats.httpThread.cpuTime += elapsed;
+    this->uv_run_time += elapsed;
+
+    // A single run may leave events behind, which would not wake up the edge triggered wait again
+    int timeout = uv_backend_timeout(this->uv_loop);
+    struct pollfd pfd = {uv_backend_fd(this->uv_loop), POLLIN, 0};
+    if (timeout == 0 || poll(&pfd, 1, 0) > 0)
+    {
+        boost::asio::post(*this->contexts.front(), [this]()
+                          { this->poll_uv_loop(); });
+        return;
+    }
+
+    if (timeout > 0)
+    {
+        this->uv_timer->expires_after(std::chrono::milliseconds(timeout));
+        this->uv_timer->async_wait([this](boost::system::error_code ec)
+                                   {
+            if (!ec)
+            {
+                this->poll_uv_loop();
+            } });
+    }
+    else
+    {
+        this->uv_timer->cancel();
+    }
+
+    if (!this->uv_fd_waiting)
+    {
+        this->uv_fd_waiting = true;
+        this->uv_fd->async_wait(boost::asio::posix::stream_descriptor::wait_read, [this](boost::system::error_code ec)
+                                {
+            this->uv_fd_waiting = false;
+            if (!ec)
+            {
+                this->poll_uv_loop();
+            } });
+    }
+}
+#else
+bool websocket_eventloop::attach_uv_loop(uv_loop_t *loop)
+{
+    // The backends of other platforms cannot be waited on from asio
+    return false;
+}
+
+void websocket_eventloop::detach_uv_loop()
+{
+}
+
+void websocket_eventloop::poll_uv_loop()
+{
 }
+#endif
 
 boost::asio::ssl::context &websocket_eventloop::get_ssl_context()
 {
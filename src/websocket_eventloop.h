@@ -2,27 +2,64 @@
 #include "extension.h"
 #include <boost/beast/core.hpp>
 #include <boost/beast/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#if defined __linux__
+#include <boost/asio/posix/stream_descriptor.hpp>
+#endif
+#include <atomic>
+#include <thread>
+#include <vector>
 
+// Upper limit of the "threads" setting in the WebSocket section of the config
+#define WEBSOCKET_MAX_THREADS 32
+
+// Runs one io_context per thread. Connections are spread over the contexts
+// when they are created and stay on theirs, so the handlers of a connection
+// never run on two threads.
 class websocket_eventloop
 {
 public:
     void OnExtLoad();
     void OnExtUnload();
-    void run();
 
+    // Returns the context for a new connection, in turns
     boost::asio::io_context &get_context();
     boost::asio::ssl::context &get_ssl_context();
 
-    websocket_eventloop() : work(context), ssl_ctx(boost::asio::ssl::context::tlsv12_client)
+    // Runs a libuv loop on the first context instead of a thread of its own, by
+    // waiting for its backend fd and its timers. Returns false where the backend
+    // fd cannot be waited on, the loop then still needs its own thread.
+    bool attach_uv_loop(uv_loop_t *loop);
+    // Blocks until the first context no longer runs the libuv loop
+    void detach_uv_loop();
+
+    websocket_eventloop() : ssl_ctx(boost::asio::ssl::context::tlsv12_client)
     {
         this->ssl_ctx.set_verify_mode(boost::asio::ssl::verify_peer);
         this->ssl_ctx.set_default_verify_paths();
     }
 
 private:
-    boost::asio::io_context context;
-    boost::asio::io_context::work work;
+    void run(boost::asio::io_context &context);
+    void poll_uv_loop();
+
+    using work_guard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+    std::vector<work_guard> work;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_context{0};
+
+    // Only used on the first context
+    uv_loop_t *uv_loop = nullptr;
+    // Microseconds spent running the HTTP loop, taken off this thread's WebSocket usage
+    uint64_t uv_run_time = 0;
+#if defined __linux__
+    std::unique_ptr<boost::asio::posix::stream_descriptor> uv_fd;
+    std::unique_ptr<boost::asio::steady_timer> uv_timer;
+    bool uv_fd_waiting = false;
+#endif
     boost::asio::ssl::context ssl_ctx;
 };
 
-extern websocket_eventloop event_loop;
\ No newline at end of file
+extern websocket_eventloop event_loop;
@@ -0,0 +1,48 @@
+#include "websocket_inbox.h"
+#include "dispatch.h"
+
+void websocket_batch::append(const char *message, size_t size, bool binary)
+{
+    this->messages.push_back({this->data.size(), size, binary});
+    this->data.append(message, size);
+    this->data.push_back('\0');
+}
+
+void websocket_batch::clear()
+{
+    // Keeps the capacity for the next frame
+    this->data.clear();
+    this->messages.clear();
+}
+
+websocket_inbox::websocket_inbox(std::function<void(const websocket_batch &)> deliver) : deliver(std::move(deliver))
+{
+}
+
+void websocket_inbox::push(const char *message, size_t size, bool binary)
+{
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->pending.append(message, size, binary);
+
+    // A single event per frame picks up everything received until it runs
+    if (this->queued)
+    {
+        return;
+    }
+    this->queued = true;
+
+    g_Dispatcher.Defer([inbox = this->shared_from_this()]()
+                       { inbox->flush(); });
+}
+
+void websocket_inbox::flush()
+{
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        std::swap(this->pending, this->delivering);
+        this->queued = false;
+    }
+
+    this->deliver(this->delivering);
+    this->delivering.clear();
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Messages received during one frame, stored back to back in a single
+// buffer. Every message is followed by a null terminator, so it can be
+// handed to plugins as a string without another copy.
+struct websocket_batch
+{
+    struct entry
+    {
+        size_t offset;
+        size_t size;
+        bool binary;
+    };
+
+    std::string data;
+    std::vector<entry> messages;
+
+    void append(const char *message, size_t size, bool binary);
+    const char *get(size_t index) const { return this->data.data() + this->messages[index].offset; }
+    void clear();
+};
+
+// Collects incoming messages of a connection on the network thread and
+// delivers them to the game thread as a single batch per frame. The two
+// batches are swapped on delivery, so once they have grown to the usual
+// traffic of a frame no more memory is allocated.
+class websocket_inbox : public std::enable_shared_from_this<websocket_inbox>
+{
+public:
+    explicit websocket_inbox(std::function<void(const websocket_batch &)> deliver);
+
+    // Called on the connection's strand
+    void push(const char *message, size_t size, bool binary);
+
+private:
+    // Called on the game thread
+    void flush();
+
+    std::function<void(const websocket_batch &)> deliver;
+
+    std::mutex mutex;
+    websocket_batch pending;
+    bool queued = false;
+
+    // Only used on the game thread
+    websocket_batch delivering;
+};
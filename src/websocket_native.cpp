@@ -2,11 +2,51 @@
 #include "websocket_connection_ssl.h"
 #include "websocket_connection.h"
 #include "url.hpp"
+#include "dispatch.h"
+#include "stats.h"
+#include "websocket_buffer_pool.h"
+#include "websocket_inbox.h"
 
 enum
 {
     WebSocket_JSON,
     Websocket_STRING,
+    WebSocket_BINARY,
+};
+
+enum
+{
+    WebSocketOpcode_Text = 1,
+    WebSocketOpcode_Binary = 2,
+};
+
+// Pawn has no byte arrays, every byte gets a cell of its own
+static std::vector<cell_t> bytes_to_cells(const uint8_t *data, size_t size)
+{
+    // PushArray needs at least one cell, even for an empty message
+    std::vector<cell_t> cells(size > 0 ? size : 1);
+    for (size_t i = 0; i < size; i++)
+    {
+        cells[i] = data[i];
+    }
+
+    return cells;
+}
+
+static int dump_to_buffer(const char *buffer, size_t size, void *data)
+{
+    reinterpret_cast<std::string *>(data)->append(buffer, size);
+    return 0;
+}
+
+struct free_deleter
+{
+    void operator()(uint8_t *buffer) const { free(buffer); }
+};
+
+struct json_deleter
+{
+    void operator()(json_t *object) const { json_decref(object); }
 };
 
 HandleError websocket_read_handle(Handle_t hndl, IPluginContext *p_context, websocket_connection_base **obj)
@@ -83,29 +123,251 @@ static cell_t native_SetReadCallback(IPluginContext *p_context, const cell_t *pa
 
     cell_t data = params[4];
 
-    connection->set_read_callback([callback, hndl_websocket, p_context, data, callback_type](auto buffer, auto size)
-                                  {
-        std::string message(reinterpret_cast<const char*>(buffer), size);
-        free(buffer);
-
-            g_RipExt.Defer([callback, hndl_websocket, message, p_context, data,callback_type]() {
-			    callback->PushCell(hndl_websocket);
-                if(callback_type == WebSocket_JSON)
-                {
-                    json_t *object = json_loads(message.data(), 0, nullptr);
-			        Handle_t handle = handlesys->CreateHandle(htJSON, object, p_context->GetIdentity(), myself->GetIdentity(), nullptr);
-                    callback->PushCell(handle);
-                }
-                else if(callback_type == Websocket_STRING)
+    if (callback_type == WebSocket_JSON)
+    {
+        connection->set_json_callback([callback, hndl_websocket, p_context, data](json_t *object)
+                                      {
+            // The event owns the JSON until a handle has been created for it
+            std::unique_ptr<json_t, json_deleter> message(object);
+
+            g_Dispatcher.Defer([callback, hndl_websocket, message = std::move(message), p_context, data]() mutable {
+                Handle_t handle = handlesys->CreateHandle(htJSON, message.get(), p_context->GetIdentity(), myself->GetIdentity(), nullptr);
+                if (handle == BAD_HANDLE)
                 {
-                    callback->PushString(message.data());
+                    return;
                 }
-			    callback->PushCell(data);
-			    callback->Execute(nullptr);
+                message.release();
+
+                callback->PushCell(hndl_websocket);
+                callback->PushCell(handle);
+                callback->PushCell(data);
+                callback->Execute(nullptr);
             }); });
+        return 1;
+    }
+
+    if (callback_type == WebSocket_BINARY)
+    {
+        connection->set_read_callback([callback, hndl_websocket, data](uint8_t *buffer, size_t size, bool binary)
+                                      {
+            std::unique_ptr<uint8_t, free_deleter> message(buffer);
+
+            g_Dispatcher.Defer([callback, hndl_websocket, message = std::move(message), size, binary, data]() {
+                std::vector<cell_t> cells = bytes_to_cells(message.get(), size);
+
+                callback->PushCell(hndl_websocket);
+                callback->PushArray(cells.data(), (unsigned int)cells.size());
+                callback->PushCell((cell_t)size);
+                callback->PushCell(binary ? WebSocketOpcode_Binary : WebSocketOpcode_Text);
+                callback->PushCell(data);
+                callback->Execute(nullptr);
+            }); });
+        return 1;
+    }
+
+    connection->set_read_callback([callback, hndl_websocket, data](uint8_t *buffer, size_t size, bool binary)
+                                  {
+        // The event owns the message until it has been delivered or dropped
+        std::unique_ptr<uint8_t, free_deleter> message(buffer);
+
+        g_Dispatcher.Defer([callback, hndl_websocket, message = std::move(message), data]() {
+            callback->PushCell(hndl_websocket);
+            callback->PushString(reinterpret_cast<const char *>(message.get()));
+            callback->PushCell(data);
+            callback->Execute(nullptr);
+        }); });
+    return 1;
+}
+
+static cell_t native_SetReadErrorCallback(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    Handle_t hndl_websocket = params[1];
+    if (websocket_read_handle(hndl_websocket, p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    IPluginFunction *callback = p_context->GetFunctionById((funcid_t)params[2]);
+    if (!callback)
+    {
+        p_context->ReportError("Invalid handler callback provided");
+        return 0;
+    }
+
+    cell_t data = params[3];
+
+    connection->set_read_error_callback([callback, hndl_websocket, data](std::string error, std::string message)
+                                        { g_Dispatcher.Defer([callback, hndl_websocket, data, error = std::move(error), message = std::move(message)]()
+                                                         {
+            callback->PushCell(hndl_websocket);
+            callback->PushString(error.c_str());
+            callback->PushString(message.c_str());
+            callback->PushCell(data);
+            callback->Execute(nullptr); }); });
+
+    return 1;
+}
+
+static cell_t native_SetBatchReadCallback(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    Handle_t hndl_websocket = params[1];
+    if (websocket_read_handle(hndl_websocket, p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    IPluginFunction *callback = p_context->GetFunctionById((funcid_t)params[2]);
+    if (!callback)
+    {
+        p_context->ReportError("Invalid handler callback provided");
+        return 0;
+    }
+
+    cell_t data = params[3];
+
+    connection->set_inbox(std::make_shared<websocket_inbox>([callback, hndl_websocket, data](const websocket_batch &batch)
+                                                            {
+        // The handle only lives for the duration of the callback
+        HandleError err;
+        HandleSecurity sec(nullptr, myself->GetIdentity());
+        Handle_t hndl_batch = handlesys->CreateHandleEx(htWebSocketBatch, const_cast<websocket_batch *>(&batch), &sec, nullptr, &err);
+        if (hndl_batch == BAD_HANDLE)
+        {
+            smutils->LogError(myself, "Could not create WebSocket batch handle (error %d)", err);
+            return;
+        }
+
+        callback->PushCell(hndl_websocket);
+        callback->PushCell(hndl_batch);
+        callback->PushCell(data);
+        callback->Execute(nullptr);
+
+        handlesys->FreeHandle(hndl_batch, &sec); }));
+
     return 1;
 }
 
+static websocket_batch *batch_read_handle(IPluginContext *p_context, Handle_t hndl)
+{
+    HandleError err;
+    HandleSecurity sec(p_context->GetIdentity(), myself->GetIdentity());
+
+    websocket_batch *batch;
+    if ((err = handlesys->ReadHandle(hndl, htWebSocketBatch, &sec, reinterpret_cast<void **>(&batch))) != HandleError_None)
+    {
+        p_context->ReportError("Invalid WebSocket batch handle %x (error %d)", hndl, err);
+        return nullptr;
+    }
+
+    return batch;
+}
+
+static const char *batch_get_message(IPluginContext *p_context, const cell_t *params, const websocket_batch::entry **entry)
+{
+    websocket_batch *batch = batch_read_handle(p_context, params[1]);
+    if (batch == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (params[2] < 0 || (size_t)params[2] >= batch->messages.size())
+    {
+        p_context->ReportError("Invalid message index %d (count: %d)", params[2], (int)batch->messages.size());
+        return nullptr;
+    }
+
+    *entry = &batch->messages[params[2]];
+    return batch->get(params[2]);
+}
+
+static cell_t native_BatchGetCount(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_batch *batch = batch_read_handle(p_context, params[1]);
+    if (batch == nullptr)
+    {
+        return 0;
+    }
+
+    return (cell_t)batch->messages.size();
+}
+
+static cell_t native_BatchGetMessageLength(IPluginContext *p_context, const cell_t *params)
+{
+    const websocket_batch::entry *entry;
+    if (batch_get_message(p_context, params, &entry) == nullptr)
+    {
+        return 0;
+    }
+
+    return (cell_t)entry->size;
+}
+
+static cell_t native_BatchGetMessage(IPluginContext *p_context, const cell_t *params)
+{
+    const websocket_batch::entry *entry;
+    const char *message = batch_get_message(p_context, params, &entry);
+    if (message == nullptr)
+    {
+        return 0;
+    }
+
+    size_t written;
+    p_context->StringToLocalUTF8(params[3], params[4], message, &written);
+    return (cell_t)written;
+}
+
+static cell_t native_BatchGetBytes(IPluginContext *p_context, const cell_t *params)
+{
+    const websocket_batch::entry *entry;
+    const char *message = batch_get_message(p_context, params, &entry);
+    if (message == nullptr)
+    {
+        return 0;
+    }
+
+    cell_t *cells;
+    p_context->LocalToPhysAddr(params[3], &cells);
+
+    size_t count = params[4] > 0 ? std::min(entry->size, (size_t)params[4]) : 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        cells[i] = (uint8_t)message[i];
+    }
+
+    return (cell_t)count;
+}
+
+static cell_t native_BatchGetOpcode(IPluginContext *p_context, const cell_t *params)
+{
+    const websocket_batch::entry *entry;
+    if (batch_get_message(p_context, params, &entry) == nullptr)
+    {
+        return 0;
+    }
+
+    return entry->binary ? WebSocketOpcode_Binary : WebSocketOpcode_Text;
+}
+
+static cell_t native_BatchGetJSON(IPluginContext *p_context, const cell_t *params)
+{
+    const websocket_batch::entry *entry;
+    const char *message = batch_get_message(p_context, params, &entry);
+    if (message == nullptr)
+    {
+        return BAD_HANDLE;
+    }
+
+    json_t *object = json_loadb(message, entry->size, 0, nullptr);
+    if (object == nullptr)
+    {
+        return BAD_HANDLE;
+    }
+
+    return handlesys->CreateHandle(htJSON, object, p_context->GetIdentity(), myself->GetIdentity(), nullptr);
+}
+
 static cell_t native_SetDisconnectCallback(IPluginContext *p_context, const cell_t *params)
 {
     websocket_connection_base *connection;
@@ -125,7 +387,7 @@ static cell_t native_SetDisconnectCallback(IPluginContext *p_context, const cell
     cell_t data = params[3];
 
     connection->set_disconnect_callback([callback, hndl_websocket, p_context, data]()
-                                        { g_RipExt.Defer([callback, hndl_websocket, p_context, data]()
+                                        { g_Dispatcher.Defer([callback, hndl_websocket, p_context, data]()
                                                          {
             callback->PushCell(hndl_websocket);
             callback->PushCell(data);
@@ -153,7 +415,7 @@ static cell_t native_SetConnectCallback(IPluginContext *p_context, const cell_t
     cell_t data = params[3];
 
     connection->set_connect_callback([callback, hndl_websocket, p_context, data]()
-                                     { g_RipExt.Defer([callback, hndl_websocket, p_context, data]()
+                                     { g_Dispatcher.Defer([callback, hndl_websocket, p_context, data]()
                                                       {
             callback->PushCell(hndl_websocket);
             callback->PushCell(data);
@@ -177,12 +439,23 @@ static cell_t native_Write(IPluginContext *p_context, const cell_t *params)
         return 0;
     }
 
-    char *result;
+    // Serialized straight into a pooled buffer, which the send queue hands back after the write
+    std::string message = buffer_pool.acquire();
+    size_t capacity = message.capacity();
 
-    result = json_dumps(object, 0);
+    if (json_dump_callback(object, &dump_to_buffer, &message, 0) != 0)
+    {
+        buffer_pool.release(std::move(message));
+        p_context->ReportError("Could not serialize JSON");
+        return 0;
+    }
 
-    connection->write(boost::asio::buffer(result, strlen(result)));
-    return 1;
+    if (message.capacity() != capacity)
+    {
+        g_Stats.websocket.bufferAllocations++;
+    }
+
+    return connection->write(std::move(message));
 }
 
 static cell_t native_WriteString(IPluginContext *p_context, const cell_t *params)
@@ -197,10 +470,83 @@ static cell_t native_WriteString(IPluginContext *p_context, const cell_t *params
 
     p_context->LocalToString(params[2], &result);
 
-    connection->write(boost::asio::buffer(result, strlen(result)));
+    std::string message = buffer_pool.acquire();
+    size_t capacity = message.capacity();
+
+    message.assign(result);
+
+    if (message.capacity() != capacity)
+    {
+        g_Stats.websocket.bufferAllocations++;
+    }
+
+    return connection->write(std::move(message));
+}
+
+static cell_t native_WriteBinary(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    if (params[3] < 0)
+    {
+        p_context->ReportError("Invalid length %d", params[3]);
+        return 0;
+    }
+
+    cell_t *data;
+    p_context->LocalToPhysAddr(params[2], &data);
+
+    std::string message = buffer_pool.acquire();
+    size_t capacity = message.capacity();
+
+    // Only the low byte of every cell is sent
+    message.resize(params[3]);
+    for (cell_t i = 0; i < params[3]; i++)
+    {
+        message[i] = (char)(data[i] & 0xFF);
+    }
+
+    if (message.capacity() != capacity)
+    {
+        g_Stats.websocket.bufferAllocations++;
+    }
+
+    return connection->write(std::move(message), true);
+}
+
+static cell_t native_SetWaterMarks(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    if (params[2] < 0 || params[3] < 0 || (params[2] > 0 && params[3] > params[2]))
+    {
+        p_context->ReportError("Invalid water marks %d and %d", params[2], params[3]);
+        return 0;
+    }
+
+    connection->set_water_marks(params[2], params[3]);
     return 1;
 }
 
+static cell_t native_GetQueuedBytes(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    return (cell_t)connection->get_queued_bytes();
+}
+
 static cell_t native_SetHeader(IPluginContext *p_context, const cell_t *params)
 {
     websocket_connection_base *connection;
@@ -216,6 +562,157 @@ static cell_t native_SetHeader(IPluginContext *p_context, const cell_t *params)
     return 1;
 }
 
+static cell_t native_SetReconnect(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    if (params[3] <= 0 || params[4] < params[3])
+    {
+        p_context->ReportError("Invalid reconnect delays %d and %d", params[3], params[4]);
+        return 0;
+    }
+
+    connection->set_reconnect(params[2] != 0, params[3], params[4]);
+    return 1;
+}
+
+static cell_t native_SetTimeouts(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    if (params[2] < 0 || params[3] < 0)
+    {
+        p_context->ReportError("Invalid timeouts %d and %d", params[2], params[3]);
+        return 0;
+    }
+
+    connection->set_timeouts(params[2], params[3]);
+    return 1;
+}
+
+static cell_t native_SetPingInterval(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    if (params[2] < 0)
+    {
+        p_context->ReportError("Invalid ping interval %d", params[2]);
+        return 0;
+    }
+
+    connection->set_ping_interval(params[2]);
+    return 1;
+}
+
+static cell_t native_GetRTT(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    return sp_ftoc(connection->get_rtt() / 1000.0f);
+}
+
+static cell_t native_GetRTTJitter(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    return sp_ftoc(connection->get_rtt_jitter() / 1000.0f);
+}
+
+static cell_t native_GetMessageBytesSent(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    return (cell_t)connection->get_message_bytes_sent();
+}
+
+static cell_t native_GetMessageBytesReceived(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    return (cell_t)connection->get_message_bytes_received();
+}
+
+static cell_t native_GetWireBytesSent(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    return (cell_t)connection->get_wire_bytes_sent();
+}
+
+static cell_t native_GetWireBytesReceived(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    return (cell_t)connection->get_wire_bytes_received();
+}
+
+static cell_t native_SetCompression(IPluginContext *p_context, const cell_t *params)
+{
+    websocket_connection_base *connection;
+    if (websocket_read_handle(params[1], p_context, &connection) != HandleError_None)
+    {
+        return 0;
+    }
+
+    // The limits zlib accepts, beast does not support a window of 8 bits
+    if (params[3] < 9 || params[3] > 15)
+    {
+        p_context->ReportError("Invalid window bits %d, must be between 9 and 15", params[3]);
+        return 0;
+    }
+
+    if (params[4] < 0 || params[4] > 9)
+    {
+        p_context->ReportError("Invalid compression level %d, must be between 0 and 9", params[4]);
+        return 0;
+    }
+
+    if (params[5] < 1 || params[5] > 9)
+    {
+        p_context->ReportError("Invalid memory level %d, must be between 1 and 9", params[5]);
+        return 0;
+    }
+
+    connection->set_compression(params[2] != 0, params[3], params[4], params[5]);
+    return 1;
+}
+
 static cell_t native_WebSocket(IPluginContext *p_context, const cell_t *params)
 {
     char *s_url;
@@ -296,16 +793,79 @@ static cell_t native_WsOpen(IPluginContext *p_context, const cell_t *params)
     return connection->ws_open();
 }
 
+enum
+{
+    WebSocketStat_MessagesSent,
+    WebSocketStat_BytesSent,
+    WebSocketStat_BufferAllocations,
+    WebSocketStat_MessagesReceived,
+    WebSocketStat_BytesReceived,
+    WebSocketStat_MalformedMessages,
+    WebSocketStat_WireBytesSent,
+    WebSocketStat_WireBytesReceived,
+    WebSocketStat_Reconnects,
+};
+
+static cell_t native_GetStat(IPluginContext *p_context, const cell_t *params)
+{
+    switch (params[1])
+    {
+    case WebSocketStat_MessagesSent:
+        return (cell_t)g_Stats.websocket.messagesSent.load();
+    case WebSocketStat_BytesSent:
+        return (cell_t)g_Stats.websocket.bytesSent.load();
+    case WebSocketStat_BufferAllocations:
+        return (cell_t)g_Stats.websocket.bufferAllocations.load();
+    case WebSocketStat_MessagesReceived:
+        return (cell_t)g_Stats.websocket.messagesReceived.load();
+    case WebSocketStat_BytesReceived:
+        return (cell_t)g_Stats.websocket.bytesReceived.load();
+    case WebSocketStat_MalformedMessages:
+        return (cell_t)g_Stats.websocket.malformedMessages.load();
+    case WebSocketStat_WireBytesSent:
+        return (cell_t)g_Stats.websocket.wireBytesSent.load();
+    case WebSocketStat_WireBytesReceived:
+        return (cell_t)g_Stats.websocket.wireBytesReceived.load();
+    case WebSocketStat_Reconnects:
+        return (cell_t)g_Stats.websocket.reconnects.load();
+    }
+
+    p_context->ReportError("Invalid WebSocket stat %d", params[1]);
+    return 0;
+}
+
 const sp_nativeinfo_t websocket_natives[] = {
     {"WebSocket.WebSocket", native_WebSocket},
     {"WebSocket.Connect", native_Connect},
     {"WebSocket.SetHeader", native_SetHeader},
     {"WebSocket.Close", native_Close},
     {"WebSocket.SetReadCallback", native_SetReadCallback},
+    {"WebSocket.SetReadErrorCallback", native_SetReadErrorCallback},
+    {"WebSocket.SetBatchReadCallback", native_SetBatchReadCallback},
     {"WebSocket.SetDisconnectCallback", native_SetDisconnectCallback},
     {"WebSocket.SetConnectCallback", native_SetConnectCallback},
     {"WebSocket.Write", native_Write},
     {"WebSocket.WriteString", native_WriteString},
+    {"WebSocket.WriteBinary", native_WriteBinary},
+    {"WebSocket.SetWaterMarks", native_SetWaterMarks},
+    {"WebSocket.SetCompression", native_SetCompression},
+    {"WebSocket.SetReconnect", native_SetReconnect},
+    {"WebSocket.SetTimeouts", native_SetTimeouts},
+    {"WebSocket.SetPingInterval", native_SetPingInterval},
+    {"WebSocket.RTT.get", native_GetRTT},
+    {"WebSocket.RTTJitter.get", native_GetRTTJitter},
+    {"WebSocket.MessageBytesSent.get", native_GetMessageBytesSent},
+    {"WebSocket.MessageBytesReceived.get", native_GetMessageBytesReceived},
+    {"WebSocket.WireBytesSent.get", native_GetWireBytesSent},
+    {"WebSocket.WireBytesReceived.get", native_GetWireBytesReceived},
+    {"WebSocket.QueuedBytes.get", native_GetQueuedBytes},
     {"WebSocket.SocketOpen", native_SocketOpen},
     {"WebSocket.WsOpen", native_WsOpen},
+    {"WebSocketBatch.Count.get", native_BatchGetCount},
+    {"WebSocketBatch.GetMessageLength", native_BatchGetMessageLength},
+    {"WebSocketBatch.GetMessage", native_BatchGetMessage},
+    {"WebSocketBatch.GetBytes", native_BatchGetBytes},
+    {"WebSocketBatch.GetOpcode", native_BatchGetOpcode},
+    {"WebSocketBatch.GetJSON", native_BatchGetJSON},
+    {"WebSocketGetStat", native_GetStat},
     {nullptr, nullptr}};
\ No newline at end of file
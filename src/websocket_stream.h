@@ -0,0 +1,66 @@
+#pragma once
+#include <boost/beast/core.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <atomic>
+#include <limits>
+#include "stats.h"
+
+namespace beast = boost::beast;
+
+// Bytes that went over the socket of one connection
+struct websocket_wire_bytes
+{
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> received{0};
+};
+
+// Never limits a stream, only counts the bytes that go over the socket. Below
+// TLS and permessage-deflate this is what is actually sent and received, so
+// it can be compared with the message sizes to get the compression ratio.
+class counting_rate_policy
+{
+    friend class beast::rate_policy_access;
+
+    // Owned by the connection, which outlives every operation on its streams
+    websocket_wire_bytes *connection = nullptr;
+
+    std::size_t available_read_bytes() const noexcept
+    {
+        return (std::numeric_limits<std::size_t>::max)();
+    }
+
+    std::size_t available_write_bytes() const noexcept
+    {
+        return (std::numeric_limits<std::size_t>::max)();
+    }
+
+    void transfer_read_bytes(std::size_t n) const noexcept
+    {
+        g_Stats.websocket.wireBytesReceived += n;
+        if (this->connection)
+        {
+            this->connection->received += n;
+        }
+    }
+
+    void transfer_write_bytes(std::size_t n) const noexcept
+    {
+        g_Stats.websocket.wireBytesSent += n;
+        if (this->connection)
+        {
+            this->connection->sent += n;
+        }
+    }
+
+    void on_timer() const noexcept
+    {
+    }
+
+public:
+    void set_connection(websocket_wire_bytes *connection) noexcept
+    {
+        this->connection = connection;
+    }
+};
+
+using websocket_tcp_stream = beast::basic_stream<boost::asio::ip::tcp, boost::asio::any_io_executor, counting_rate_policy>;